@@ -1,216 +1,1048 @@
 #include "Calculator.h"
+#include "Lexer.h"
+#include "MappedFile.h"
+#include "WorkerPool.h"
+#include <algorithm>
+#include <memory>
 #include <cmath>
-#include <regex>
+#include <unordered_set>
+#include <utility>
 
 using namespace std;
 
-double GetIdentifierValue(const string& identifierValue)
+IdentifierId CCalculator::Intern(string_view name)
 {
-	try
+	if (auto search = m_ids.find(name); search != m_ids.end())
 	{
-		return stod(identifierValue);
+		return search->second;
 	}
-	catch (exception& e)
+	auto* nameData = static_cast<char*>(m_arena.allocate(name.size(), alignof(char)));
+	copy(name.begin(), name.end(), nameData);
+	string_view internedName(nameData, name.size());
+
+	IdentifierId id = m_names.size();
+	m_ids.emplace(internedName, id);
+	m_names.push_back(internedName);
+	m_types.emplace_back();
+	m_values.push_back(NAN);
+	m_dependents.emplace_back();
+	m_functionSlots.push_back(NO_FUNCTION_SLOT);
+	return id;
+}
+
+IdentifierId CCalculator::FindId(string_view name) const
+{
+	if (auto search = m_ids.find(name); search != m_ids.end())
 	{
-		return NAN;
+		return search->second;
+	}
+	return NO_IDENTIFIER;
+}
+
+void CCalculator::Declare(IdentifierId id, IdentifierType type)
+{
+	if (!m_types[id])
+	{
+		++m_declaredCount;
+	}
+	else if (m_types[id] == IdentifierType::FUNCTION)
+	{
+		RemoveDependency(GetBody(id), id);
+		GetBody(id) = FunctionBody(&m_pool);
+	}
+	if (type == IdentifierType::FUNCTION && m_functionSlots[id] == NO_FUNCTION_SLOT)
+	{
+		m_functionSlots[id] = static_cast<uint32_t>(m_bodies.size());
+		m_bodies.emplace_back(&m_pool);
+		m_functionValues.emplace_back();
+	}
+	if (m_types[id] == IdentifierType::FUNCTION || type == IdentifierType::FUNCTION)
+	{
+		erase_if(m_plans, [id](const auto& plan) {
+			return binary_search(plan.second.closure.begin(), plan.second.closure.end(), id);
+		});
+	}
+	if (m_types[id] != type)
+	{
+		if (m_types[id])
+		{
+			m_sortedIds[static_cast<size_t>(*m_types[id])].hasStale = true;
+		}
+		m_sortedIds[static_cast<size_t>(type)].ids.push_back(id);
+	}
+	m_types[id] = type;
+}
+
+FunctionBody& CCalculator::GetBody(IdentifierId id)
+{
+	return m_bodies[m_functionSlots[id]];
+}
+
+const FunctionBody& CCalculator::GetBody(IdentifierId id) const
+{
+	return m_bodies[m_functionSlots[id]];
+}
+
+optional<double>& CCalculator::GetCachedValue(IdentifierId id) const
+{
+	return m_functionValues[m_functionSlots[id]];
+}
+
+template <typename Container>
+void Abandon(Container& container, pmr::memory_resource* resource)
+{
+	// the old object is overwritten without running its destructor, its memory goes with the pool
+	construct_at(&container, resource);
+}
+
+void CCalculator::Reset()
+{
+	Abandon(m_ids, &m_pool);
+	Abandon(m_names, &m_pool);
+	Abandon(m_types, &m_pool);
+	Abandon(m_values, &m_pool);
+	Abandon(m_dependents, &m_pool);
+	Abandon(m_functionSlots, &m_pool);
+	Abandon(m_bodies, &m_pool);
+	Abandon(m_functionValues, &m_pool);
+	for (SortedIds& sortedIds: m_sortedIds)
+	{
+		Abandon(sortedIds.ids, &m_pool);
+		sortedIds.sortedCount = 0;
+		sortedIds.hasStale = false;
+	}
+	m_declaredCount = 0;
+	m_changes.clear();
+	m_changeIndex.clear();
+	m_plans.clear();
+	m_pool.release();
+	m_arena.release();
+}
+
+unique_ptr<CCalculator> CCalculator::Clone() const
+{
+	auto copy = make_unique<CCalculator>();
+	copy->Reserve(m_names.size());
+	for (IdentifierId id = 0; id < m_names.size(); ++id)
+	{
+		copy->Intern(m_names[id]);
+		copy->m_types[id] = m_types[id];
+		copy->m_values[id] = m_values[id];
+		// pmr containers keep the allocator of the copy on assignment
+		copy->m_dependents[id] = m_dependents[id];
+	}
+	copy->m_functionSlots = m_functionSlots;
+	copy->m_bodies.reserve(m_bodies.size());
+	for (const FunctionBody& body: m_bodies)
+	{
+		// FunctionBody is not allocator-aware, so it is assigned rather than copy-constructed
+		copy->m_bodies.emplace_back(&copy->m_pool) = body;
+	}
+	copy->m_functionValues = m_functionValues;
+	copy->m_declaredCount = m_declaredCount;
+	for (size_t i = 0; i < m_sortedIds.size(); ++i)
+	{
+		copy->m_sortedIds[i].ids = m_sortedIds[i].ids;
+		copy->m_sortedIds[i].sortedCount = m_sortedIds[i].sortedCount;
+		copy->m_sortedIds[i].hasStale = m_sortedIds[i].hasStale;
 	}
+	copy->m_reactive = m_reactive;
+	return copy;
 }
 
-bool CCalculator::AddVariable(const string& newVar)
+bool CCalculator::AddVariable(string_view newVar)
 {
-    Identifier newIdentifier;
-	newIdentifier.identifierName = newVar;
-	if (auto search = m_identifiers.find(newIdentifier);
-		search != m_identifiers.end())
+	IdentifierId id = Intern(newVar);
+	if (m_types[id])
 	{
 		return false; // variable already exist
 	}
-	newIdentifier.identifierType = IdentifierType::VARIABLE;
-	m_identifiers.insert(newIdentifier);
+	Declare(id, IdentifierType::VARIABLE);
+	InvalidateDependents(id);
     return true;
 }
 
-bool IsEqual(double a, double b)
+bool CCalculator::AddVariableWithValue(string_view variable, string_view value)
 {
-	return abs(a - b) < numeric_limits<double>::epsilon();
+	return AddVariableWithValue(variable, ParseNumber(value, NumberExtent::PREFIX).value_or(NAN));
 }
 
-bool CCalculator::AddVariableWithValue(const string& variable, const string& value)
+bool CCalculator::AddVariableWithValue(string_view variable, double value)
 {
-	Identifier newIdentifier;
-	newIdentifier.identifierName = variable;
-	newIdentifier.identifierValue = value;
-	newIdentifier.identifierType = IdentifierType::VARIABLE;
-	if (auto search = m_identifiers.find(newIdentifier);
-		search != m_identifiers.end())
+	IdentifierId id = Intern(variable);
+	if (m_types[id] == IdentifierType::VARIABLE && m_values[id] == value)
 	{
-		if (newIdentifier.identifierValue == value)
-		{
-			return true;
-		}
-		m_identifiers.erase(search);
+		return true;
 	}
-	m_identifiers.insert(newIdentifier);
+	Declare(id, IdentifierType::VARIABLE);
+	m_values[id] = value;
+	InvalidateDependents(id);
 	return true;
 }
 
-bool CCalculator::AddVariableWithOtherVariableValue(const string& variable, const string& otherVariable)
+bool CCalculator::AddVariableWithOtherVariableValue(string_view variable, string_view otherVariable)
 {
 	if (variable == otherVariable)
 	{
 		return true;
 	}
-	Identifier oldIdent;
-	oldIdent.identifierName = otherVariable;
-	if (auto search = m_identifiers.find(oldIdent);
-		search != m_identifiers.end())
+	IdentifierId otherId = FindId(otherVariable);
+	if (otherId == NO_IDENTIFIER)
+	{
+		return false;
+	}
+	if (m_types[otherId] != IdentifierType::VARIABLE)
+	{
+		return false;
+	}
+	return AddVariableWithValue(variable, m_values[otherId]);
+}
+
+bool CCalculator::AssignVariables(span<const pair<string_view, double>> values)
+{
+	for (const auto& [name, value]: values)
 	{
-		if (search->identifierType != IdentifierType::VARIABLE)
+		if (IdentifierId id = FindId(name); id != NO_IDENTIFIER && m_types[id] == IdentifierType::FUNCTION)
 		{
 			return false;
 		}
-		Identifier newIdent;
-		newIdent.identifierName = variable;
-		newIdent.identifierValue = search->identifierValue;
-		newIdent.identifierType = IdentifierType::VARIABLE;
-		m_identifiers.insert(newIdent);
-		return true;
 	}
-	return false;
+	// grows geometrically, an exact reserve would reallocate every dense vector on each small commit
+	if (size_t required = m_names.size() + values.size(); required > m_names.capacity())
+	{
+		Reserve(max(required, 2 * m_names.capacity()));
+	}
+	vector<IdentifierId> changed;
+	changed.reserve(values.size());
+	for (const auto& [name, value]: values)
+	{
+		IdentifierId id = Intern(name);
+		if (m_types[id] == IdentifierType::VARIABLE && m_values[id] == value)
+		{
+			continue;
+		}
+		if (!m_types[id])
+		{
+			Declare(id, IdentifierType::VARIABLE);
+		}
+		m_values[id] = value;
+		changed.push_back(id);
+	}
+	InvalidateDependents(changed);
+	return true;
 }
 
-const std::set<Identifier>& CCalculator::GetAllVariables() const
+namespace
+{
+string_view TrimSpaces(string_view text)
 {
-	return m_identifiers;
+	size_t begin = text.find_first_not_of(" \t\r");
+	if (begin == string_view::npos)
+	{
+		return {};
+	}
+	return text.substr(begin, text.find_last_not_of(" \t\r") - begin + 1);
 }
+} // namespace
 
-double CCalculator::GetVariableValueByName(const string variableName) const
+optional<vector<pair<string_view, double>>> CCalculator::ParseVariables(string_view csv)
 {
-	Identifier identifier;
-	identifier.identifierName = variableName;
-	if (auto search = m_identifiers.find(identifier);
-		search != m_identifiers.end())
+	vector<pair<string_view, double>> rows;
+	bool isFirstLine = true;
+	while (!csv.empty())
 	{
-		return GetIdentifierValue(search->identifierValue);
+		size_t lineEnd = min(csv.find('\n'), csv.size());
+		string_view line = TrimSpaces(csv.substr(0, lineEnd));
+		csv.remove_prefix(min(lineEnd + 1, csv.size()));
+		size_t comma = line.find(',');
+		string_view name = TrimSpaces(line.substr(0, comma));
+		string_view value = comma == string_view::npos ? string_view() : TrimSpaces(line.substr(comma + 1));
+		if (exchange(isFirstLine, false) && name == "name" && value == "value")
+		{
+			continue;
+		}
+		if (line.empty())
+		{
+			continue;
+		}
+		auto number = ParseNumber(value);
+		if (!number || !IsValidIdentifierName(name))
+		{
+			return nullopt;
+		}
+		rows.emplace_back(name, *number);
+	}
+	return rows;
+}
+
+bool CCalculator::ImportVariables(string_view csv)
+{
+	auto rows = ParseVariables(csv);
+	return rows && AssignVariables(*rows);
+}
+
+bool CCalculator::ImportVariablesFromFile(const string& path)
+{
+	CMappedFile file;
+	return file.Open(path) && ImportVariables(file.GetData());
+}
+
+void CCalculator::Reserve(size_t identifierCount)
+{
+	m_ids.reserve(identifierCount);
+	m_names.reserve(identifierCount);
+	m_types.reserve(identifierCount);
+	m_values.reserve(identifierCount);
+	m_dependents.reserve(identifierCount);
+	m_functionSlots.reserve(identifierCount);
+}
+
+set<Identifier> CCalculator::GetAllVariables() const
+{
+	set<Identifier> identifiers;
+	for (IdentifierId id = 0; id < m_names.size(); ++id)
+	{
+		if (m_types[id])
+		{
+			identifiers.insert(identifiers.end(), { string(m_names[id]), *m_types[id], GetValue(id) });
+		}
+	}
+	return identifiers;
+}
+
+span<const IdentifierId> CCalculator::GetSortedIds(IdentifierType type) const
+{
+	SortedIds& sortedIds = m_sortedIds[static_cast<size_t>(type)];
+	auto& ids = sortedIds.ids;
+	if (sortedIds.hasStale)
+	{
+		// an id that changed kind and came back is listed twice, unique below drops the copy
+		erase_if(ids, [this, type](IdentifierId id) {
+			return m_types[id] != type;
+		});
+		sortedIds.sortedCount = 0;
+		sortedIds.hasStale = false;
+	}
+	if (sortedIds.sortedCount < ids.size())
+	{
+		auto byName = [this](IdentifierId left, IdentifierId right) {
+			return m_names[left] < m_names[right];
+		};
+		auto tail = ids.begin() + static_cast<ptrdiff_t>(sortedIds.sortedCount);
+		sort(tail, ids.end(), byName);
+		inplace_merge(ids.begin(), tail, ids.end(), byName);
+		ids.erase(unique(ids.begin(), ids.end()), ids.end());
+		sortedIds.sortedCount = ids.size();
 	}
-	return NAN;
+	return ids;
 }
 
-optional<IdentifierType> CCalculator::GetIdentifierType(const string& identifierName) const
+optional<IdentifierId> CCalculator::Find(string_view name) const
 {
-	Identifier identifier;
-	identifier.identifierName = identifierName;
-	if (auto search = m_identifiers.find(identifier);
-		search != m_identifiers.end())
+	IdentifierId id = FindId(name);
+	if (id == NO_IDENTIFIER || !m_types[id])
 	{
-		return search->identifierType;
+		return nullopt;
 	}
-	return nullopt;
+	return id;
 }
 
-bool CCalculator::AddFunctionWithVariable(const std::string& functionName, const std::string& variableName)
+IdentifierType CCalculator::GetType(IdentifierId id) const
+{
+	return *m_types[id];
+}
+
+string_view CCalculator::GetName(IdentifierId id) const
+{
+	return m_names[id];
+}
+
+double CCalculator::GetValue(IdentifierId id) const
+{
+	if (m_types[id] != IdentifierType::FUNCTION)
+	{
+		return m_values[id];
+	}
+	if (m_collectStats && GetCachedValue(id))
+	{
+		++m_stats.cacheHits;
+	}
+	return GetFunctionValue(id);
+}
+
+double CCalculator::GetVariableValueByName(string_view variableName) const
+{
+	IdentifierId id = FindId(variableName);
+	if (id == NO_IDENTIFIER)
+	{
+		return NAN;
+	}
+	return GetValue(id);
+}
+
+optional<IdentifierType> CCalculator::GetIdentifierType(string_view identifierName) const
+{
+	IdentifierId id = FindId(identifierName);
+	if (id == NO_IDENTIFIER)
+	{
+		return nullopt;
+	}
+	return m_types[id];
+}
+
+bool CCalculator::AddFunctionWithVariable(string_view functionName, string_view variableName)
 {
 	if (functionName == variableName)
 	{
 		return false;
 	}
-	Identifier identifierVar;
-	identifierVar.identifierName = variableName;
-	if (auto search = m_identifiers.find(identifierVar);
-		search != m_identifiers.end())
+	IdentifierId variableId = FindId(variableName);
+	if (variableId == NO_IDENTIFIER || m_types[variableId] != IdentifierType::VARIABLE)
+	{
+		return false;
+	}
+	IdentifierId functionId = Intern(functionName);
+	if (!m_types[functionId])
+	{
+		Declare(functionId, IdentifierType::FUNCTION);
+		// a one-instruction body reads the variable, so later lets reach the function
+		FunctionBody body(&m_pool);
+		body.code.push_back({ OpCode::PUSH_IDENTIFIER, Operation::ADD, static_cast<uint32_t>(variableId) });
+		body.operands.push_back(variableId);
+		body.stackSize = 1;
+		GetBody(functionId) = std::move(body);
+		AddDependency(GetBody(functionId), functionId);
+		InvalidateDependents(functionId);
+	}
+	return true;
+}
+
+bool CCalculator::AddFunctionWithOperation(string_view functionName, string_view operation)
+{
+	auto body = CompileExpression(operation, [this](string_view name) {
+		return Intern(name);
+	}, &m_pool);
+	if (!body)
+	{
+		return false;
+	}
+	IdentifierId id = Intern(functionName);
+	Declare(id, IdentifierType::FUNCTION);
+	m_values[id] = NAN;
+	GetBody(id) = std::move(*body);
+	AddDependency(GetBody(id), id);
+	InvalidateDependents(id);
+	return true;
+}
+
+void CCalculator::AddDependency(const FunctionBody& body, IdentifierId functionId)
+{
+	for (IdentifierId operand: body.operands)
+	{
+		m_dependents[operand].push_back(functionId);
+	}
+}
+
+void CCalculator::RemoveDependency(const FunctionBody& body, IdentifierId functionId)
+{
+	for (IdentifierId operand: body.operands)
+	{
+		auto& dependents = m_dependents[operand];
+		if (auto it = find(dependents.begin(), dependents.end(), functionId);
+			it != dependents.end())
+		{
+			*it = dependents.back();
+			dependents.pop_back();
+		}
+	}
+}
+
+void CCalculator::InvalidateDependents(IdentifierId id)
+{
+	InvalidateDependents(span(&id, 1));
+}
+
+void CCalculator::InvalidateDependents(span<const IdentifierId> ids)
+{
+	vector<IdentifierId> invalidated;
+	vector<optional<double>> oldValues;
+	for (IdentifierId id: ids)
+	{
+		if (m_reactive && m_types[id] == IdentifierType::FUNCTION)
+		{
+			invalidated.push_back(id);
+			oldValues.push_back(GetCachedValue(id));
+		}
+		if (m_functionSlots[id] != NO_FUNCTION_SLOT)
+		{
+			GetCachedValue(id).reset();
+		}
+	}
+	vector<IdentifierId> toVisit(ids.begin(), ids.end());
+	while (!toVisit.empty())
+	{
+		IdentifierId current = toVisit.back();
+		toVisit.pop_back();
+		for (IdentifierId dependent: m_dependents[current])
+		{
+			// a function that is not cached has no cached dependents either
+			if (GetCachedValue(dependent))
+			{
+				if (m_reactive)
+				{
+					invalidated.push_back(dependent);
+					oldValues.push_back(GetCachedValue(dependent));
+				}
+				GetCachedValue(dependent).reset();
+				toVisit.push_back(dependent);
+			}
+		}
+	}
+	if (m_reactive)
+	{
+		RecomputeFunctions(invalidated, oldValues);
+	}
+}
+
+void CCalculator::RecomputeFunctions(const vector<IdentifierId>& invalidated, const vector<optional<double>>& oldValues)
+{
+	// same levels as EvaluateAllFunctions, but only over the invalidated functions:
+	// in reactive mode every other function is cached
+	auto isPending = [this](IdentifierId id) {
+		return m_types[id] == IdentifierType::FUNCTION && !GetCachedValue(id);
+	};
+	unordered_map<IdentifierId, size_t> pendingOperands;
+	vector<IdentifierId> level;
+	for (IdentifierId id: invalidated)
+	{
+		size_t count = count_if(GetBody(id).operands.begin(), GetBody(id).operands.end(), isPending);
+		pendingOperands[id] = count;
+		if (count == 0)
+		{
+			level.push_back(id);
+		}
+	}
+
+	vector<IdentifierId> nextLevel;
+	for (size_t depth = 1; !level.empty(); ++depth)
+	{
+		EvaluateLevel(level, depth);
+		nextLevel.clear();
+		for (IdentifierId id: level)
+		{
+			for (IdentifierId dependent: m_dependents[id])
+			{
+				if (isPending(dependent) && --pendingOperands[dependent] == 0)
+				{
+					nextLevel.push_back(dependent);
+				}
+			}
+		}
+		swap(level, nextLevel);
+	}
+
+	for (size_t i = 0; i < invalidated.size(); ++i)
+	{
+		// cycles are left for the recursive evaluation
+		double newValue = GetFunctionValue(invalidated[i]);
+		double oldValue = oldValues[i].value_or(newValue);
+		if (oldValue == newValue || (isnan(oldValue) && isnan(newValue)))
+		{
+			continue;
+		}
+		// one entry per function keeps the list bounded however long nobody takes it
+		auto [change, isNew] = m_changeIndex.try_emplace(invalidated[i], m_changes.size());
+		if (isNew)
+		{
+			m_changes.push_back({ string(m_names[invalidated[i]]), oldValue, newValue });
+		}
+		else
+		{
+			m_changes[change->second].newValue = newValue;
+		}
+	}
+}
+
+void CCalculator::SetReactive(bool reactive)
+{
+	m_reactive = reactive;
+	if (m_reactive)
+	{
+		EvaluateAllFunctions();
+	}
+}
+
+bool CCalculator::IsReactive() const
+{
+	return m_reactive;
+}
+
+vector<FunctionChange> CCalculator::TakeChanges()
+{
+	m_changeIndex.clear();
+	vector<FunctionChange> changes = exchange(m_changes, {});
+	// a function that changed back to its first value has no change left
+	erase_if(changes, [](const FunctionChange& change) {
+		return change.oldValue == change.newValue || (isnan(change.oldValue) && isnan(change.newValue));
+	});
+	return changes;
+}
+
+void CCalculator::SetStatsEnabled(bool enabled)
+{
+	m_collectStats = enabled;
+}
+
+const EvaluationStats& CCalculator::GetEvaluationStats() const
+{
+	return m_stats;
+}
+
+void CCalculator::ResetEvaluationStats()
+{
+	m_stats = {};
+}
+
+double CCalculator::GetFunctionValue(string_view functionName) const
+{
+	IdentifierId id = FindId(functionName);
+	if (id == NO_IDENTIFIER || m_types[id] != IdentifierType::FUNCTION)
+	{
+		return NAN;
+	}
+	return GetValue(id);
+}
+
+double CCalculator::GetFunctionValue(IdentifierId id) const
+{
+	if (GetCachedValue(id))
 	{
-		if (search->identifierType == IdentifierType::VARIABLE)
+		return *GetCachedValue(id);
+	}
+	// post-order walk with an explicit stack, so chain depth is not limited by the call stack;
+	// a function on the stack holds a NAN placeholder, an operand leading back to it is a cycle and reads NAN
+	struct Frame
+	{
+		IdentifierId id;
+		size_t nextOperand;
+	};
+	vector<Frame> stack{ { id, 0 } };
+	GetCachedValue(id) = NAN;
+	while (!stack.empty())
+	{
+		Frame& frame = stack.back();
+		const auto& operands = GetBody(frame.id).operands;
+		if (frame.nextOperand < operands.size())
 		{
-			Identifier idenfifierFunc;
-			idenfifierFunc.identifierName = functionName;
-			idenfifierFunc.identifierType = IdentifierType::FUNCTION;
-			idenfifierFunc.identifierValue = search->identifierValue;
-			m_identifiers.insert(idenfifierFunc);
-			return true;
+			IdentifierId operand = operands[frame.nextOperand++];
+			if (m_types[operand] != IdentifierType::FUNCTION)
+			{
+				continue;
+			}
+			if (GetCachedValue(operand))
+			{
+				if (m_collectStats)
+				{
+					++m_stats.cacheHits;
+				}
+				continue;
+			}
+			GetCachedValue(operand) = NAN;
+			stack.push_back({ operand, 0 });
+			continue;
 		}
+		// every function operand is cached by now, evaluation does not go deeper
+		GetCachedValue(frame.id) = CalculateFunctionValue(frame.id);
+		if (m_collectStats)
+		{
+			++m_stats.nodeVisits;
+			m_stats.maxDepth = max(m_stats.maxDepth, stack.size());
+		}
+		stack.pop_back();
 	}
-	return false;
+	return *GetCachedValue(id);
 }
 
-bool CCalculator::AddFunctionWithOperation(const string& functionName, const string& operation)
+bool CCalculator::CompileFunction(string_view functionName)
 {
-	Identifier functionToAdd {functionName};
-	if (auto search = m_identifiers.find(functionToAdd);
-		search != m_identifiers.end())
+	IdentifierId id = FindId(functionName);
+	if (id == NO_IDENTIFIER || m_types[id] != IdentifierType::FUNCTION)
 	{
-		m_identifiers.erase(search);
+		return false;
 	}
-	functionToAdd.identifierType = IdentifierType::FUNCTION;
-	functionToAdd.identifierValue = operation;
-	m_identifiers.insert(functionToAdd);
+	GetPlan(id);
 	return true;
 }
 
-double GetOperationResult(double operand1, const string& operation, double operand2)
+double CCalculator::EvaluateCompiledFunction(string_view functionName)
 {
-	if (operation == "+")
+	IdentifierId id = FindId(functionName);
+	if (id == NO_IDENTIFIER || m_types[id] != IdentifierType::FUNCTION)
 	{
-		return operand1 + operand2;
+		return NAN;
 	}
-	if (operation == "-")
+	return ExecutePlan(GetPlan(id), m_values.data());
+}
+
+EvaluationPlan& CCalculator::GetPlan(IdentifierId functionId)
+{
+	auto it = m_plans.find(functionId);
+	if (it == m_plans.end())
 	{
-		return operand1 - operand2;
+		it = m_plans.emplace(functionId, BuildPlan(functionId)).first;
 	}
-	if (operation == "*")
+	return it->second;
+}
+
+EvaluationPlan CCalculator::BuildPlan(IdentifierId functionId) const
+{
+	// functions with a body are inlined, everything else is a leaf read from m_values
+	auto isInlined = [this](IdentifierId id) {
+		return m_types[id] == IdentifierType::FUNCTION && !GetBody(id).code.empty();
+	};
+	EvaluationPlan plan;
+	vector<IdentifierId> order;
+	unordered_map<IdentifierId, bool> isDone;
+	vector<pair<IdentifierId, size_t>> stack{ { functionId, 0 } };
+	isDone[functionId] = false;
+	bool hasCycle = false;
+	while (!stack.empty() && !hasCycle)
 	{
-		return operand1 * operand2;
+		auto& [id, next] = stack.back();
+		const auto& operands = GetBody(id).operands;
+		if (next == operands.size())
+		{
+			isDone[id] = true;
+			order.push_back(id);
+			stack.pop_back();
+			continue;
+		}
+		IdentifierId operand = operands[next++];
+		plan.closure.push_back(operand);
+		if (!isInlined(operand))
+		{
+			continue;
+		}
+		if (auto search = isDone.find(operand); search == isDone.end())
+		{
+			isDone[operand] = false;
+			stack.emplace_back(operand, 0);
+		}
+		else if (!search->second)
+		{
+			hasCycle = true;
+		}
 	}
-	if (operation == "/")
+	plan.closure.push_back(functionId);
+	sort(plan.closure.begin(), plan.closure.end());
+	plan.closure.erase(unique(plan.closure.begin(), plan.closure.end()), plan.closure.end());
+	if (hasCycle)
 	{
-		if (IsEqual(operand2, 0))
+		// a cycle reads as NAN, the plan stays until one of its functions is redefined
+		plan.slots.push_back(NAN);
+		return plan;
+	}
+
+	unordered_map<IdentifierId, uint32_t> slots;
+	auto newSlot = [&plan](double value) {
+		plan.slots.push_back(value);
+		return static_cast<uint32_t>(plan.slots.size() - 1);
+	};
+	auto leafSlot = [&](IdentifierId id) {
+		auto [it, isNew] = slots.try_emplace(id, 0);
+		if (isNew)
 		{
-			return INFINITY;
+			it->second = newSlot(NAN);
+			plan.inputs.emplace_back(id, it->second);
 		}
-		return operand1 / operand2;
+		return it->second;
+	};
+	vector<uint32_t> slotStack;
+	for (IdentifierId id: order)
+	{
+		if (!isInlined(id))
+		{
+			slots[id] = leafSlot(id);
+			continue;
+		}
+		const FunctionBody& body = GetBody(id);
+		slotStack.clear();
+		for (const Instruction& instruction: body.code)
+		{
+			switch (instruction.opCode)
+			{
+			case OpCode::PUSH_IDENTIFIER:
+				slotStack.push_back(isInlined(instruction.argument) ? slots.at(instruction.argument) : leafSlot(instruction.argument));
+				break;
+			case OpCode::PUSH_CONSTANT:
+				slotStack.push_back(newSlot(body.constants[instruction.argument]));
+				break;
+			case OpCode::NEGATE:
+			{
+				uint32_t destination = newSlot(NAN);
+				plan.code.push_back({ OpCode::NEGATE, Operation::ADD, slotStack.back(), slotStack.back(), destination });
+				slotStack.back() = destination;
+				break;
+			}
+			case OpCode::APPLY:
+			{
+				uint32_t sourceB = slotStack.back();
+				slotStack.pop_back();
+				uint32_t destination = newSlot(NAN);
+				plan.code.push_back({ OpCode::APPLY, instruction.operation, slotStack.back(), sourceB, destination });
+				slotStack.back() = destination;
+				break;
+			}
+			}
+		}
+		slots[id] = slotStack.back();
 	}
+	plan.resultSlot = slots.at(functionId);
+	return plan;
 }
 
-double CCalculator::GetFunctionValue(const string& functionName) const
+void CCalculator::EvaluateAllFunctions() const
 {
-	Identifier functionToFind{functionName};
-	if (auto search = m_identifiers.find(functionToFind);
-		search != m_identifiers.end())
+	// Kahn's algorithm over functions that are not cached yet: a function becomes
+	// ready once all of its function operands are cached, every ready set is one level
+	auto isPending = [this](IdentifierId id) {
+		return id != NO_IDENTIFIER && m_types[id] == IdentifierType::FUNCTION && !GetCachedValue(id);
+	};
+	vector<size_t> pendingOperands(m_names.size(), 0);
+	vector<IdentifierId> level;
+	for (IdentifierId id = 0; id < m_names.size(); ++id)
 	{
-		regex rgx(R"(([a-zA-Z_][a-zA-Z0-9_]*)([+-/*])([a-zA-Z_][a-zA-Z0-9_]*))");
-		smatch submatch;
-		if (!regex_match(search->identifierValue, submatch, rgx))
+		if (!isPending(id))
 		{
-			return GetVariableValueByName(search->identifierValue);
+			continue;
 		}
-		auto firstOperandType = GetIdentifierType(submatch[1]);
-		double firstOperandValue, secondOperandValue;
-		if (!firstOperandType)
+		pendingOperands[id] = count_if(GetBody(id).operands.begin(), GetBody(id).operands.end(), isPending);
+		if (pendingOperands[id] == 0)
 		{
-			return NAN;
+			level.push_back(id);
 		}
-		if (firstOperandType == IdentifierType::VARIABLE)
+	}
+
+	vector<IdentifierId> nextLevel;
+	for (size_t depth = 1; !level.empty(); ++depth)
+	{
+		EvaluateLevel(level, depth);
+		nextLevel.clear();
+		for (IdentifierId id: level)
 		{
-			firstOperandValue = GetVariableValueByName(submatch[1]);
+			for (IdentifierId dependent: m_dependents[id])
+			{
+				if (isPending(dependent) && --pendingOperands[dependent] == 0)
+				{
+					nextLevel.push_back(dependent);
+				}
+			}
 		}
-		if (firstOperandType == IdentifierType::FUNCTION)
+		swap(level, nextLevel);
+	}
+
+	// whatever is left is part of a cycle
+	for (IdentifierId id = 0; id < m_names.size(); ++id)
+	{
+		if (m_types[id] == IdentifierType::FUNCTION)
 		{
-			firstOperandValue = GetFunctionValue(submatch[1]);
+			GetFunctionValue(id);
 		}
+	}
+}
 
-		auto secondOperandType = GetIdentifierType(submatch[3]);
-		if (!secondOperandType)
+void CCalculator::EvaluateLevel(const vector<IdentifierId>& level, size_t depth) const
+{
+	if (m_collectStats)
+	{
+		m_stats.nodeVisits += level.size();
+		m_stats.maxDepth = max(m_stats.maxDepth, depth);
+	}
+	// all operands of the level are cached, so workers only write their own slots
+	auto evaluateRange = [this, &level](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i)
 		{
-			return NAN;
+			GetCachedValue(level[i]) = CalculateFunctionValue(level[i]);
 		}
-		if (secondOperandType == IdentifierType::VARIABLE)
+	};
+	// the pool outlives every level, so a level costs a wake-up instead of starting threads
+	size_t chunkCount = level.size() / PARALLEL_LEVEL_SIZE;
+	if (chunkCount < 2 || CWorkerPool::GetInstance().GetThreadCount() < 2)
+	{
+		evaluateRange(0, level.size());
+		return;
+	}
+	CWorkerPool::GetInstance().Run(chunkCount, [&](size_t chunk) {
+		evaluateRange(chunk * level.size() / chunkCount, (chunk + 1) * level.size() / chunkCount);
+	});
+}
+
+double CCalculator::GetOperandValue(IdentifierId id) const
+{
+	if (!m_types[id])
+	{
+		return NAN;
+	}
+	if (m_types[id] == IdentifierType::FUNCTION)
+	{
+		return GetFunctionValue(id);
+	}
+	return m_values[id];
+}
+
+double CCalculator::CalculateFunctionValue(IdentifierId id) const
+{
+	const FunctionBody& body = GetBody(id);
+	// only functions loaded from a version 1 snapshot have no code, see Snapshot.h
+	if (body.code.empty())
+	{
+		return m_values[id];
+	}
+	return ExecuteFunctionBody(body, [this](IdentifierId operand) {
+		return GetOperandValue(operand);
+	});
+}
+
+optional<vector<IdentifierId>> CCalculator::GetSweepOrder(IdentifierId functionId, IdentifierId variableId) const
+{
+	// functions downstream of the variable
+	unordered_set<IdentifierId> affected;
+	vector<IdentifierId> toVisit{ variableId };
+	while (!toVisit.empty())
+	{
+		IdentifierId current = toVisit.back();
+		toVisit.pop_back();
+		for (IdentifierId dependent: m_dependents[current])
 		{
-			secondOperandValue = GetVariableValueByName(submatch[3]);
+			if (m_types[dependent] == IdentifierType::FUNCTION && affected.insert(dependent).second)
+			{
+				toVisit.push_back(dependent);
+			}
 		}
-		if (secondOperandType == IdentifierType::FUNCTION)
+	}
+	// affected part of the target's closure in post-order, operands first
+	vector<IdentifierId> order;
+	if (!affected.contains(functionId))
+	{
+		return order;
+	}
+	unordered_map<IdentifierId, bool> isDone;
+	vector<pair<IdentifierId, size_t>> stack{ { functionId, 0 } };
+	isDone[functionId] = false;
+	while (!stack.empty())
+	{
+		auto& [id, next] = stack.back();
+		const auto& operands = GetBody(id).operands;
+		if (next == operands.size())
+		{
+			isDone[id] = true;
+			order.push_back(id);
+			stack.pop_back();
+			continue;
+		}
+		IdentifierId operand = operands[next++];
+		if (!affected.contains(operand))
+		{
+			continue;
+		}
+		if (auto search = isDone.find(operand); search == isDone.end())
+		{
+			isDone[operand] = false;
+			stack.emplace_back(operand, 0);
+		}
+		else if (!search->second)
+		{
+			return nullopt;
+		}
+	}
+	return order;
+}
+
+vector<double> CCalculator::Sweep(string_view functionName, string_view variableName, const vector<double>& values) const
+{
+	IdentifierId functionId = FindId(functionName);
+	IdentifierId variableId = FindId(variableName);
+	if (functionId == NO_IDENTIFIER || variableId == NO_IDENTIFIER
+		|| m_types[functionId] != IdentifierType::FUNCTION || m_types[variableId] != IdentifierType::VARIABLE)
+	{
+		return vector<double>(values.size(), NAN);
+	}
+	auto sweepOrder = GetSweepOrder(functionId, variableId);
+	if (!sweepOrder)
+	{
+		// the function takes part in a cycle
+		return vector<double>(values.size(), NAN);
+	}
+	const vector<IdentifierId>& order = *sweepOrder;
+	if (order.empty())
+	{
+		return vector<double>(values.size(), GetFunctionValue(functionId));
+	}
+
+	// one column block per affected function plus scratch columns for the evaluation stack
+	unordered_map<IdentifierId, size_t> columnIndex;
+	size_t stackSize = 0;
+	for (IdentifierId id: order)
+	{
+		columnIndex.emplace(id, columnIndex.size());
+		stackSize = max(stackSize, GetBody(id).stackSize);
+	}
+	vector<double> columns(order.size() * SWEEP_BLOCK_SIZE);
+	vector<double> scratch(stackSize * SWEEP_BLOCK_SIZE);
+	vector<const double*> stack(stackSize);
+	vector<double> result(values.size());
+
+	for (size_t blockStart = 0; blockStart < values.size(); blockStart += SWEEP_BLOCK_SIZE)
+	{
+		size_t blockSize = min(SWEEP_BLOCK_SIZE, values.size() - blockStart);
+		for (IdentifierId id: order)
 		{
-			secondOperandValue = GetFunctionValue(submatch[3]);
+			const FunctionBody& body = GetBody(id);
+			size_t top = 0;
+			for (const Instruction& instruction: body.code)
+			{
+				double* slot = scratch.data() + top * SWEEP_BLOCK_SIZE;
+				switch (instruction.opCode)
+				{
+				case OpCode::PUSH_IDENTIFIER:
+				{
+					IdentifierId operand = instruction.argument;
+					if (operand == variableId)
+					{
+						stack[top++] = values.data() + blockStart;
+					}
+					else if (auto column = columnIndex.find(operand); column != columnIndex.end())
+					{
+						stack[top++] = columns.data() + column->second * SWEEP_BLOCK_SIZE;
+					}
+					else
+					{
+						fill(slot, slot + blockSize, GetOperandValue(operand));
+						stack[top++] = slot;
+					}
+					break;
+				}
+				case OpCode::PUSH_CONSTANT:
+					fill(slot, slot + blockSize, body.constants[instruction.argument]);
+					stack[top++] = slot;
+					break;
+				case OpCode::NEGATE:
+					slot -= SWEEP_BLOCK_SIZE;
+					NegateColumn(stack[top - 1], slot, blockSize);
+					stack[top - 1] = slot;
+					break;
+				case OpCode::APPLY:
+					slot -= 2 * SWEEP_BLOCK_SIZE;
+					ApplyOperationToColumns(stack[top - 2], instruction.operation, stack[top - 1], slot, blockSize);
+					stack[--top - 1] = slot;
+					break;
+				}
+			}
+			double* column = columns.data() + columnIndex[id] * SWEEP_BLOCK_SIZE;
+			copy(stack[0], stack[0] + blockSize, column);
 		}
-		return GetOperationResult(firstOperandValue, submatch[2], secondOperandValue);
+		const double* target = columns.data() + columnIndex[functionId] * SWEEP_BLOCK_SIZE;
+		copy(target, target + blockSize, result.begin() + static_cast<ptrdiff_t>(blockStart));
 	}
-	return NAN;
+	return result;
 }
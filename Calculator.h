@@ -1,10 +1,18 @@
 #ifndef CALCULATOR_CALCULATOR_H
 #define CALCULATOR_CALCULATOR_H
 
+#include "Expression.h"
+#include <array>
 #include <set>
+#include <span>
 #include <string>
+#include <string_view>
 #include <cmath>
+#include <memory>
+#include <memory_resource>
 #include <optional>
+#include <unordered_map>
+#include <vector>
 
 enum class IdentifierType
 {
@@ -16,8 +24,7 @@ struct Identifier
 {
 	std::string identifierName;
 	IdentifierType identifierType;
-//	double identifierValue = NAN;
-	std::string identifierValue = "nan";
+	double identifierValue = NAN;
 
 	bool operator<(const Identifier& left) const
 	{
@@ -25,24 +32,165 @@ struct Identifier
 	}
 };
 
+// value of a function before and after a recomputation in reactive mode
+struct FunctionChange
+{
+	std::string functionName;
+	double oldValue;
+	double newValue;
+};
+
+struct EvaluationStats
+{
+	// functions whose body was evaluated
+	size_t nodeVisits = 0;
+	// lookups answered from the cache
+	size_t cacheHits = 0;
+	// deepest chain of functions evaluated at once
+	size_t maxDepth = 0;
+};
+
 class CCalculator
 {
 public:
-    bool AddVariable(const std::string& newVar);
+    bool AddVariable(std::string_view newVar);
 
-	bool AddVariableWithValue(const std::string& variable, const std::string& value);
-	bool AddVariableWithOtherVariableValue(const std::string& variable, const std::string& otherVariable);
-//	double GetIdentifierValue(const std::string& identifierName) const;
-	double GetVariableValueByName(const std::string variableName) const;
+	bool AddVariableWithValue(std::string_view variable, std::string_view value);
+	bool AddVariableWithValue(std::string_view variable, double value);
+	bool AddVariableWithOtherVariableValue(std::string_view variable, std::string_view otherVariable);
+	// functions report their current value
+	double GetVariableValueByName(std::string_view variableName) const;
+	// every name becomes a variable with its value, dependent functions are invalidated once for all;
+	// nothing changes if a name is a function
+	bool AssignVariables(std::span<const std::pair<std::string_view, double>> values);
+	// name,value per line, an optional name,value header line is skipped; nullopt if any line is malformed
+	static std::optional<std::vector<std::pair<std::string_view, double>>> ParseVariables(std::string_view csv);
+	// parsed and assigned as above, nothing changes if any line is malformed or names a function
+	bool ImportVariables(std::string_view csv);
+	bool ImportVariablesFromFile(const std::string& path);
 
-	bool AddFunctionWithVariable(const std::string& functionName, const std::string& variableName);
-	bool AddFunctionWithOperation(const std::string& functionName, const std::string& operation);
-	double GetFunctionValue(const std::string& functionName) const;
+	bool AddFunctionWithVariable(std::string_view functionName, std::string_view variableName);
+	// operation is an infix expression over identifiers and numbers, false if it does not compile
+	bool AddFunctionWithOperation(std::string_view functionName, std::string_view operation);
+	double GetFunctionValue(std::string_view functionName) const;
+	// flattens the function and its whole fn closure into a plan, kept until a function
+	// of the closure is redefined; false if there is no such function
+	bool CompileFunction(std::string_view functionName);
+	// runs the plan, compiling it first if needed; reads current variable values, not the cache
+	double EvaluateCompiledFunction(std::string_view functionName);
 	
-	[[nodiscard]] std::optional<IdentifierType> GetIdentifierType(const std::string& identifier) const;
-	[[nodiscard]] const std::set<Identifier>& GetAllVariables() const;
+	// caches every function value, independent functions are evaluated in parallel
+	void EvaluateAllFunctions() const;
+	// value of the function for every given value of the variable, other identifiers keep their values;
+	// functions depending on the variable are evaluated column-wise in blocks
+	std::vector<double> Sweep(std::string_view functionName, std::string_view variableName,
+		const std::vector<double>& values) const;
+
+	[[nodiscard]] std::optional<IdentifierType> GetIdentifierType(std::string_view identifier) const;
+	// handle of a declared identifier for GetType, GetName and GetValue, no copies are made
+	[[nodiscard]] std::optional<IdentifierId> Find(std::string_view name) const;
+	[[nodiscard]] IdentifierType GetType(IdentifierId id) const;
+	// every change recomputes the functions it affects right away, in topological order,
+	// so reading a function value never evaluates anything
+	void SetReactive(bool reactive);
+	[[nodiscard]] bool IsReactive() const;
+	// values changed by recomputation since the last call, one entry per function with its
+	// value before the first and after the last change, in order of first change
+	std::vector<FunctionChange> TakeChanges();
+	// counting is off by default and must stay off while other threads read the calculator
+	void SetStatsEnabled(bool enabled);
+	[[nodiscard]] const EvaluationStats& GetEvaluationStats() const;
+	void ResetEvaluationStats();
+	// drops every identifier and gives all memory back at once
+	void Reset();
+	// independent copy that allocates from its own arena and pool, caches included
+	[[nodiscard]] std::unique_ptr<CCalculator> Clone() const;
+	// binary image of the symbol table and compiled function bodies, see Snapshot.h
+	bool SaveSnapshot(const std::string& path) const;
+	// replaces the current state; the state is kept if the file cannot be opened,
+	// a damaged file leaves the calculator empty
+	bool LoadSnapshot(const std::string& path);
+	// sorted by name, built on demand
+	[[nodiscard]] std::set<Identifier> GetAllVariables() const;
+	// ids of one kind sorted by name; ids declared since the previous call are sorted and merged in,
+	// which writes to the calculator like filling a function cache does
+	[[nodiscard]] std::span<const IdentifierId> GetSortedIds(IdentifierType type) const;
+	[[nodiscard]] std::string_view GetName(IdentifierId id) const;
+	// value of a variable, or of a function after evaluating it
+	[[nodiscard]] double GetValue(IdentifierId id) const;
 private:
-    std::set<Identifier> m_identifiers;
+	static constexpr size_t PARALLEL_LEVEL_SIZE = 4096;
+	static constexpr size_t SWEEP_BLOCK_SIZE = 1024;
+	static constexpr uint32_t NO_FUNCTION_SLOT = static_cast<uint32_t>(-1);
+
+	// names referenced by a fn before being declared get an id without a type
+	IdentifierId Intern(std::string_view name);
+	[[nodiscard]] IdentifierId FindId(std::string_view name) const;
+	void Declare(IdentifierId id, IdentifierType type);
+	// only for ids that have been declared a function at some point
+	FunctionBody& GetBody(IdentifierId id);
+	const FunctionBody& GetBody(IdentifierId id) const;
+	std::optional<double>& GetCachedValue(IdentifierId id) const;
+
+	double GetFunctionValue(IdentifierId id) const;
+	double CalculateFunctionValue(IdentifierId id) const;
+	// depth is the 1-based index of the level, the longest chain of functions ending in it
+	void EvaluateLevel(const std::vector<IdentifierId>& level, size_t depth) const;
+	double GetOperandValue(IdentifierId id) const;
+	// nullopt if the affected functions form a cycle
+	std::optional<std::vector<IdentifierId>> GetSweepOrder(IdentifierId functionId, IdentifierId variableId) const;
+	void AddDependency(const FunctionBody& body, IdentifierId functionId);
+	void RemoveDependency(const FunctionBody& body, IdentifierId functionId);
+	EvaluationPlan BuildPlan(IdentifierId functionId) const;
+	EvaluationPlan& GetPlan(IdentifierId functionId);
+	void Reserve(size_t identifierCount);
+	void InvalidateDependents(IdentifierId id);
+	void InvalidateDependents(std::span<const IdentifierId> ids);
+	// oldValues holds the cached value of each invalidated function, if it had one
+	void RecomputeFunctions(const std::vector<IdentifierId>& invalidated, const std::vector<std::optional<double>>& oldValues);
+
+	struct NameHash
+	{
+		using is_transparent = void;
+		size_t operator()(std::string_view name) const
+		{
+			return std::hash<std::string_view>()(name);
+		}
+	};
+
+	// names live in the arena until Reset; containers allocate from the pool, which reuses
+	// the blocks they free and draws from the heap
+	std::pmr::monotonic_buffer_resource m_arena;
+	std::pmr::unsynchronized_pool_resource m_pool{ std::pmr::new_delete_resource() };
+
+	std::pmr::unordered_map<std::string_view, IdentifierId, NameHash, std::equal_to<>> m_ids{ &m_pool };
+	std::pmr::vector<std::string_view> m_names{ &m_pool };
+	std::pmr::vector<std::optional<IdentifierType>> m_types{ &m_pool };
+	std::pmr::vector<double> m_values{ &m_pool };
+	// operand id -> functions whose body refers to it
+	std::pmr::vector<std::pmr::vector<IdentifierId>> m_dependents{ &m_pool };
+	// id -> index into m_bodies and m_functionValues, given when the id is first declared a function
+	std::pmr::vector<uint32_t> m_functionSlots{ &m_pool };
+	std::pmr::vector<FunctionBody> m_bodies{ &m_pool };
+	mutable std::pmr::vector<std::optional<double>> m_functionValues{ &m_pool };
+	// per IdentifierType: sorted prefix followed by ids declared since, entries whose type changed are dropped lazily
+	struct SortedIds
+	{
+		std::pmr::vector<IdentifierId> ids;
+		size_t sortedCount = 0;
+		bool hasStale = false;
+	};
+	mutable std::array<SortedIds, 2> m_sortedIds{ SortedIds{ std::pmr::vector<IdentifierId>(&m_pool) },
+		SortedIds{ std::pmr::vector<IdentifierId>(&m_pool) } };
+	size_t m_declaredCount = 0;
+	// compiled plans by target function
+	std::unordered_map<IdentifierId, EvaluationPlan> m_plans;
+	bool m_reactive = false;
+	bool m_collectStats = false;
+	mutable EvaluationStats m_stats;
+	std::vector<FunctionChange> m_changes;
+	// function -> its entry in m_changes
+	std::unordered_map<IdentifierId, size_t> m_changeIndex;
 };
 
 #endif //CALCULATOR_CALCULATOR_H
@@ -0,0 +1,304 @@
+#include "Expression.h"
+#include "Lexer.h"
+#include <algorithm>
+#include <limits>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+namespace
+{
+class CExpressionCompiler
+{
+public:
+	CExpressionCompiler(string_view expression, const NameResolver& resolveName, pmr::memory_resource* resource)
+		: m_lexer(expression)
+		, m_resolveName(resolveName)
+		, m_body(resource)
+	{}
+
+	optional<FunctionBody> Compile()
+	{
+		if (!ParseExpression() || !m_lexer.IsAtEnd())
+		{
+			return nullopt;
+		}
+		ResolveNames();
+		return std::move(m_body);
+	}
+
+private:
+	bool ParseExpression()
+	{
+		if (!ParseTerm())
+		{
+			return false;
+		}
+		for (Token token = m_lexer.PeekToken(); token.IsSymbol('+') || token.IsSymbol('-'); token = m_lexer.PeekToken())
+		{
+			m_lexer.NextToken();
+			if (!ParseTerm())
+			{
+				return false;
+			}
+			Emit({ OpCode::APPLY, token.IsSymbol('+') ? Operation::ADD : Operation::SUB });
+		}
+		return true;
+	}
+
+	bool ParseTerm()
+	{
+		if (!ParseUnary())
+		{
+			return false;
+		}
+		for (Token token = m_lexer.PeekToken(); token.IsSymbol('*') || token.IsSymbol('/') || token.IsSymbol('%');
+			 token = m_lexer.PeekToken())
+		{
+			m_lexer.NextToken();
+			if (!ParseUnary())
+			{
+				return false;
+			}
+			Emit({ OpCode::APPLY, token.IsSymbol('*') ? Operation::MUL : token.IsSymbol('/') ? Operation::DIV : Operation::MOD });
+		}
+		return true;
+	}
+
+	// every nested parenthesis, sign and exponent passes through here
+	bool ParseUnary()
+	{
+		if (m_nestingDepth == MAX_NESTING_DEPTH)
+		{
+			return false;
+		}
+		++m_nestingDepth;
+		bool isParsed = ParseSignedPower();
+		--m_nestingDepth;
+		return isParsed;
+	}
+
+	bool ParseSignedPower()
+	{
+		Token token = m_lexer.PeekToken();
+		if (token.IsSymbol('+'))
+		{
+			m_lexer.NextToken();
+			return ParseUnary();
+		}
+		if (token.IsSymbol('-'))
+		{
+			m_lexer.NextToken();
+			if (!ParseUnary())
+			{
+				return false;
+			}
+			Emit({ OpCode::NEGATE });
+			return true;
+		}
+		return ParsePower();
+	}
+
+	// right associative and tighter than unary minus: -2^2 is -4, 2^3^2 is 2^9
+	bool ParsePower()
+	{
+		if (!ParsePrimary())
+		{
+			return false;
+		}
+		if (!m_lexer.PeekToken().IsSymbol('^'))
+		{
+			return true;
+		}
+		m_lexer.NextToken();
+		if (!ParseUnary())
+		{
+			return false;
+		}
+		Emit({ OpCode::APPLY, Operation::POW });
+		return true;
+	}
+
+	bool ParsePrimary()
+	{
+		Token token = m_lexer.NextToken();
+		if (token.IsSymbol('('))
+		{
+			return ParseExpression() && m_lexer.NextToken().IsSymbol(')');
+		}
+		if (token.type == TokenType::NUMBER)
+		{
+			auto value = ParseNumber(token.text);
+			if (!value)
+			{
+				return false;
+			}
+			m_body.constants.push_back(*value);
+			Emit({ OpCode::PUSH_CONSTANT, Operation::ADD, static_cast<uint32_t>(m_body.constants.size() - 1) });
+			return true;
+		}
+		if (token.type != TokenType::IDENTIFIER)
+		{
+			return false;
+		}
+		// min and max are calls only when followed by a parenthesis, otherwise they are plain identifiers
+		if ((token.text == "min" || token.text == "max") && m_lexer.PeekToken().IsSymbol('('))
+		{
+			m_lexer.NextToken();
+			if (!ParseExpression() || !m_lexer.NextToken().IsSymbol(',') || !ParseExpression()
+				|| !m_lexer.NextToken().IsSymbol(')'))
+			{
+				return false;
+			}
+			Emit({ OpCode::APPLY, token.text == "min" ? Operation::MIN : Operation::MAX });
+			return true;
+		}
+		// the argument is an index into m_names until ResolveNames replaces it with the id
+		auto name = find(m_names.begin(), m_names.end(), token.text);
+		if (name == m_names.end())
+		{
+			name = m_names.insert(name, token.text);
+		}
+		Emit({ OpCode::PUSH_IDENTIFIER, Operation::ADD, static_cast<uint32_t>(name - m_names.begin()) });
+		return true;
+	}
+
+	// names are resolved only once the whole expression is valid, so rejected ones declare nothing
+	void ResolveNames()
+	{
+		m_body.operands.reserve(m_names.size());
+		for (string_view name: m_names)
+		{
+			m_body.operands.push_back(m_resolveName(name));
+		}
+		for (Instruction& instruction: m_body.code)
+		{
+			if (instruction.opCode == OpCode::PUSH_IDENTIFIER)
+			{
+				instruction.argument = static_cast<uint32_t>(m_body.operands[instruction.argument]);
+			}
+		}
+	}
+
+	void Emit(Instruction instruction)
+	{
+		m_body.code.push_back(instruction);
+		if (instruction.opCode == OpCode::PUSH_IDENTIFIER || instruction.opCode == OpCode::PUSH_CONSTANT)
+		{
+			m_body.stackSize = max(m_body.stackSize, ++m_stackDepth);
+		}
+		else if (instruction.opCode == OpCode::APPLY)
+		{
+			--m_stackDepth;
+		}
+	}
+
+	// keeps recursion within the stack for any input
+	static constexpr size_t MAX_NESTING_DEPTH = 1000;
+
+	CLexer m_lexer;
+	const NameResolver& m_resolveName;
+	FunctionBody m_body;
+	// distinct identifier names in order of first use
+	vector<string_view> m_names;
+	size_t m_stackDepth = 0;
+	size_t m_nestingDepth = 0;
+};
+} // namespace
+
+optional<FunctionBody> CompileExpression(string_view expression, const NameResolver& resolveName,
+	pmr::memory_resource* resource)
+{
+	return CExpressionCompiler(expression, resolveName, resource).Compile();
+}
+
+double ExecutePlan(EvaluationPlan& plan, const double* values)
+{
+	double* slots = plan.slots.data();
+	for (const auto& [id, slot]: plan.inputs)
+	{
+		slots[slot] = values[id];
+	}
+	for (const PlanInstruction& instruction: plan.code)
+	{
+		slots[instruction.destination] = instruction.opCode == OpCode::NEGATE
+			? -slots[instruction.sourceA]
+			: GetOperationResult(slots[instruction.sourceA], instruction.operation, slots[instruction.sourceB]);
+	}
+	return slots[plan.resultSlot];
+}
+
+void NegateColumn(const double* operand, double* result, size_t size)
+{
+	for (size_t i = 0; i < size; ++i)
+	{
+		result[i] = -operand[i];
+	}
+}
+
+namespace
+{
+#ifdef __AVX2__
+template <Operation operation>
+__m256d ApplyOperationToLanes(__m256d operand1, __m256d operand2)
+{
+	if constexpr (operation == Operation::ADD)
+	{
+		return _mm256_add_pd(operand1, operand2);
+	}
+	else if constexpr (operation == Operation::SUB)
+	{
+		return _mm256_sub_pd(operand1, operand2);
+	}
+	else if constexpr (operation == Operation::MUL)
+	{
+		return _mm256_mul_pd(operand1, operand2);
+	}
+	else
+	{
+		static_assert(operation == Operation::DIV);
+		const __m256d magnitude = _mm256_andnot_pd(_mm256_set1_pd(-0.0), operand2);
+		const __m256d isZero = _mm256_cmp_pd(magnitude, _mm256_set1_pd(numeric_limits<double>::epsilon()), _CMP_LT_OQ);
+		return _mm256_blendv_pd(_mm256_div_pd(operand1, operand2), _mm256_set1_pd(INFINITY), isZero);
+	}
+}
+#endif
+
+// the operation is resolved once per column, the loop body is specialised for it
+template <Operation operation>
+void ApplyToColumns(const double* operand1, const double* operand2, double* result, size_t size)
+{
+	size_t i = 0;
+#ifdef __AVX2__
+	if constexpr (operation <= Operation::DIV)
+	{
+		for (; i + 4 <= size; i += 4)
+		{
+			_mm256_storeu_pd(result + i,
+				ApplyOperationToLanes<operation>(_mm256_loadu_pd(operand1 + i), _mm256_loadu_pd(operand2 + i)));
+		}
+	}
+#endif
+	for (; i < size; ++i)
+	{
+		result[i] = ApplyOperation<operation>(operand1[i], operand2[i]);
+	}
+}
+
+using ColumnKernel = void (*)(const double*, const double*, double*, size_t);
+
+template <Operation operation>
+struct ColumnOperation
+{
+	static constexpr ColumnKernel value = &ApplyToColumns<operation>;
+};
+
+constexpr auto COLUMN_KERNELS = MakeOperationTable<ColumnKernel, ColumnOperation>(make_index_sequence<OPERATION_COUNT>());
+} // namespace
+
+void ApplyOperationToColumns(const double* operand1, Operation operation, const double* operand2, double* result, size_t size)
+{
+	COLUMN_KERNELS[static_cast<size_t>(operation)](operand1, operand2, result, size);
+}
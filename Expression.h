@@ -0,0 +1,200 @@
+#ifndef CALCULATOR_EXPRESSION_H
+#define CALCULATOR_EXPRESSION_H
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <memory_resource>
+#include <optional>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+using IdentifierId = size_t;
+constexpr IdentifierId NO_IDENTIFIER = static_cast<IdentifierId>(-1);
+
+// new operations go at the end, snapshots store them by value
+enum class Operation : uint8_t
+{
+	ADD,
+	SUB,
+	MUL,
+	DIV,
+	MOD,
+	POW,
+	MIN,
+	MAX
+};
+constexpr uint8_t OPERATION_COUNT = static_cast<uint8_t>(Operation::MAX) + 1;
+
+enum class OpCode : uint8_t
+{
+	PUSH_IDENTIFIER,
+	PUSH_CONSTANT,
+	NEGATE,
+	APPLY
+};
+
+// argument is an identifier id for PUSH_IDENTIFIER and a constant index for PUSH_CONSTANT
+struct Instruction
+{
+	OpCode opCode;
+	Operation operation = Operation::ADD;
+	uint32_t argument = 0;
+};
+
+// fn body compiled once at declaration into stack machine code
+struct FunctionBody
+{
+	FunctionBody() = default;
+	explicit FunctionBody(std::pmr::memory_resource* resource)
+		: code(resource)
+		, constants(resource)
+		, operands(resource)
+	{}
+
+	std::pmr::vector<Instruction> code;
+	std::pmr::vector<double> constants;
+	// distinct identifiers the body reads
+	std::pmr::vector<IdentifierId> operands;
+	size_t stackSize = 0;
+};
+
+// slots[destination] = slots[sourceA] operation slots[sourceB], NEGATE ignores sourceB
+struct PlanInstruction
+{
+	OpCode opCode;
+	Operation operation;
+	uint32_t sourceA;
+	uint32_t sourceB;
+	uint32_t destination;
+};
+
+// a function together with every fn it depends on, flattened in topological order
+// over a dense slot buffer; constants are stored in their slots once
+struct EvaluationPlan
+{
+	std::vector<PlanInstruction> code;
+	std::vector<double> slots;
+	// leaf identifier -> slot its value is copied to before every run
+	std::vector<std::pair<IdentifierId, uint32_t>> inputs;
+	uint32_t resultSlot = 0;
+	// sorted ids of the functions and leaves the plan was built from
+	std::vector<IdentifierId> closure;
+};
+
+// values is indexed by identifier id
+double ExecutePlan(EvaluationPlan& plan, const double* values);
+
+using NameResolver = std::function<IdentifierId(std::string_view name)>;
+
+// expression := term {(+|-) term}, term := unary {(*|/|%) unary},
+// unary := (+|-) unary | power, power := primary [^ unary],
+// primary := number | identifier | (min|max) ( expression , expression ) | ( expression )
+// nullopt for invalid expressions, including ones nested deeper than 1000 levels;
+// resolveName is called only once the expression is known to be valid
+std::optional<FunctionBody> CompileExpression(std::string_view expression, const NameResolver& resolveName,
+	std::pmr::memory_resource* resource = std::pmr::get_default_resource());
+
+template <Operation operation>
+double ApplyOperation(double operand1, double operand2)
+{
+	if constexpr (operation == Operation::ADD)
+	{
+		return operand1 + operand2;
+	}
+	else if constexpr (operation == Operation::SUB)
+	{
+		return operand1 - operand2;
+	}
+	else if constexpr (operation == Operation::MUL)
+	{
+		return operand1 * operand2;
+	}
+	else if constexpr (operation == Operation::DIV)
+	{
+		return std::abs(operand2) < std::numeric_limits<double>::epsilon() ? INFINITY : operand1 / operand2;
+	}
+	else if constexpr (operation == Operation::MOD)
+	{
+		return std::fmod(operand1, operand2);
+	}
+	else if constexpr (operation == Operation::POW)
+	{
+		return std::pow(operand1, operand2);
+	}
+	else if constexpr (operation == Operation::MIN)
+	{
+		return std::isnan(operand1) || std::isnan(operand2) ? NAN : std::min(operand1, operand2);
+	}
+	else
+	{
+		static_assert(operation == Operation::MAX);
+		return std::isnan(operand1) || std::isnan(operand2) ? NAN : std::max(operand1, operand2);
+	}
+}
+
+// one entry per Operation, so an operation is resolved by indexing instead of comparing
+template <typename Function, template <Operation> typename Entry, size_t... Indices>
+constexpr std::array<Function, sizeof...(Indices)> MakeOperationTable(std::index_sequence<Indices...>)
+{
+	return { Entry<static_cast<Operation>(Indices)>::value... };
+}
+
+template <Operation operation>
+struct ScalarOperation
+{
+	static constexpr double (*value)(double, double) = &ApplyOperation<operation>;
+};
+
+inline constexpr auto OPERATION_TABLE = MakeOperationTable<double (*)(double, double), ScalarOperation>(
+	std::make_index_sequence<OPERATION_COUNT>());
+
+inline double GetOperationResult(double operand1, Operation operation, double operand2)
+{
+	return OPERATION_TABLE[static_cast<size_t>(operation)](operand1, operand2);
+}
+
+// element-wise kernels used by columnar evaluation, result may alias an operand
+void NegateColumn(const double* operand, double* result, size_t size);
+void ApplyOperationToColumns(const double* operand1, Operation operation, const double* operand2, double* result, size_t size);
+
+template <typename OperandValue>
+double ExecuteFunctionBody(const FunctionBody& body, OperandValue&& getOperandValue)
+{
+	constexpr size_t SMALL_STACK_SIZE = 32;
+	double smallStack[SMALL_STACK_SIZE];
+	std::vector<double> largeStack;
+	double* stack = smallStack;
+	if (body.stackSize > SMALL_STACK_SIZE)
+	{
+		largeStack.resize(body.stackSize);
+		stack = largeStack.data();
+	}
+	size_t top = 0;
+	for (const Instruction& instruction: body.code)
+	{
+		switch (instruction.opCode)
+		{
+		case OpCode::PUSH_IDENTIFIER:
+			stack[top++] = getOperandValue(static_cast<IdentifierId>(instruction.argument));
+			break;
+		case OpCode::PUSH_CONSTANT:
+			stack[top++] = body.constants[instruction.argument];
+			break;
+		case OpCode::NEGATE:
+			stack[top - 1] = -stack[top - 1];
+			break;
+		case OpCode::APPLY:
+			--top;
+			stack[top - 1] = GetOperationResult(stack[top - 1], instruction.operation, stack[top]);
+			break;
+		}
+	}
+	return top == 1 ? stack[0] : NAN;
+}
+
+#endif // CALCULATOR_EXPRESSION_H
@@ -1,260 +1,611 @@
 #include "IOControl.h"
 #include "Calculator.h"
+#include "Lexer.h"
+#include "MappedFile.h"
+#include <algorithm>
+#include <bit>
+#include <charconv>
 #include <iostream>
-#include <sstream>
-#include <regex>
 #include <iomanip>
 
 using namespace std;
 CControl::CControl(CCalculator& calc, std::istream& input, std::ostream& output)
 	: m_calc(calc), m_input(input), m_output(output),
 	m_actionMap({
-		{"var", [this](istream& strm) {
-			 return DeclareVariable(strm);
+		{"var", [this](string_view args) {
+			 return DeclareVariable(args);
 		 }},
-		{"let", [this](istream& strm) {
-			 return AssignValueToVariable(strm);
+		{"let", [this](string_view args) {
+			 return AssignValueToVariable(args);
 		 }},
-		{"print", [this](istream& strm) {
-			 return PrintValue(strm);
+		{"print", [this](string_view args) {
+			 return PrintValue(args);
 		 }},
-		{"printvars", [this](istream& strm) {
-			 return PrintVars(strm);
+		{"printvars", [this](string_view args) {
+			 return PrintVars(args);
 		 }},
-		{"fn", [this](istream& strm) {
-			 return DeclareFunction(strm);
+		{"fn", [this](string_view args) {
+			 return DeclareFunction(args);
 		 }},
-		{"printfns", [this](istream& strm) {
-			 return PrintFunctions(strm);
+		{"printfns", [this](string_view args) {
+			 return PrintFunctions(args);
+		 }},
+		{"sweep", [this](string_view args) {
+			 return SweepFunction(args);
+		 }},
+		{"reactive", [this](string_view args) {
+			 return SetReactive(args);
+		 }},
+		{"changes", [this](string_view args) {
+			 return PrintChanges(args);
+		 }},
+		{"stats", [this](string_view args) {
+			 return Stats(args);
+		 }},
+		{"import", [this](string_view args) {
+			 return ImportVariables(args);
+		 }},
+		{"begin", [this](string_view args) {
+			 return BeginBatch(args);
+		 }},
+		{"commit", [this](string_view args) {
+			 return EndBatch(args, true);
+		 }},
+		{"rollback", [this](string_view args) {
+			 return EndBatch(args, false);
 		 }}
 	})
 {}
 
 bool CControl::HandleCommand()
 {
-	string commandLine;
-	getline(m_input, commandLine);
-	istringstream strm(commandLine);
+	getline(m_input, m_commandLine);
+	bool result = ExecuteCommand(m_commandLine);
+	FlushOutput();
+	m_output.flush();
+	return result;
+}
 
-	string action;
-	strm >> action;
-	auto it = m_actionMap.find(action);
-	if (it != m_actionMap.end())
+void CControl::RunScript()
+{
+	string chunk(INPUT_CHUNK_SIZE, '\0');
+	string pending;
+	while (m_input.read(chunk.data(), static_cast<streamsize>(chunk.size())) || m_input.gcount() > 0)
 	{
-		return it->second(strm);
+		pending.append(chunk.data(), static_cast<size_t>(m_input.gcount()));
+		pending.erase(0, ExecuteLines(pending));
 	}
-	return false;
+	if (!pending.empty())
+	{
+		ExecuteCommand(pending);
+	}
+	FlushOutput();
+	m_output.flush();
 }
 
-bool IsRestOfCommandEmpty(istream& inpStrm)
+void CControl::RunScript(string_view script)
 {
-	if (inpStrm.eof())
+	size_t executed = ExecuteLines(script);
+	if (executed < script.size())
 	{
-		return true;
+		ExecuteCommand(script.substr(executed));
 	}
-	string restOfCommand;
-	inpStrm >> restOfCommand;
-	if (restOfCommand.empty())
+	FlushOutput();
+	m_output.flush();
+}
+
+size_t CControl::RunLines(string_view text)
+{
+	size_t executed = ExecuteLines(text);
+	FlushOutput();
+	m_output.flush();
+	return executed;
+}
+
+size_t CControl::ExecuteLines(string_view text)
+{
+	size_t lineStart = 0;
+	for (size_t lineEnd = text.find('\n'); lineEnd != string_view::npos;
+		 lineEnd = text.find('\n', lineStart))
 	{
-		return true;
+		ExecuteCommand(text.substr(lineStart, lineEnd - lineStart));
+		lineStart = lineEnd + 1;
+		if (m_buffer.view().size() >= OUTPUT_FLUSH_THRESHOLD)
+		{
+			FlushOutput();
+		}
+	}
+	return lineStart;
+}
+
+void CControl::FlushOutput()
+{
+	m_output << m_buffer.view();
+	m_buffer.str(string());
+}
+
+bool CControl::ExecuteCommand(string_view commandLine)
+{
+	CLexer lexer(commandLine);
+	string_view action = lexer.NextWord();
+	auto it = m_actionMap.find(action);
+	if (it == m_actionMap.end())
+	{
+		return false;
 	}
-	return false;
+	string_view args = commandLine.substr(action.data() + action.size() - commandLine.data());
+	if (!m_statsEnabled)
+	{
+		return it->second(args);
+	}
+	auto start = chrono::steady_clock::now();
+	bool result = it->second(args);
+	RecordCommand(it->first, result, chrono::steady_clock::now() - start);
+	return result;
+}
+
+void CControl::RecordCommand(string_view action, bool succeeded, chrono::nanoseconds time)
+{
+	auto it = m_commandStats.find(action);
+	if (it == m_commandStats.end())
+	{
+		it = m_commandStats.emplace(action, CommandStats()).first;
+	}
+	CommandStats& stats = it->second;
+	++stats.count;
+	stats.failures += succeeded ? 0 : 1;
+	stats.totalTime += time;
+	auto microseconds = static_cast<uint64_t>(chrono::duration_cast<chrono::microseconds>(time).count());
+	++stats.latencyBuckets[min<size_t>(bit_width(microseconds), CommandStats::LATENCY_BUCKET_COUNT - 1)];
+}
+
+void CControl::SetStatsEnabled(bool enabled)
+{
+	m_statsEnabled = enabled;
+	m_calc.SetStatsEnabled(enabled);
+}
+
+const CommandStatsMap& CControl::GetCommandStats() const
+{
+	return m_commandStats;
 }
 
-bool CControl::DeclareVariable(istream& inpStrm)
+bool CControl::DeclareVariable(string_view args)
 {
-	string variableName;
-	inpStrm >> variableName;
+	CLexer lexer(args);
+	string_view variableName = lexer.NextWord();
 	if (variableName.empty())
 	{
-		m_output << "No variable to declare" << endl;
+		m_buffer << "No variable to declare" << '\n';
 		return false;
 	}
-	if (!IsRestOfCommandEmpty(inpStrm))
+	if (!lexer.IsAtEnd())
 	{
-		m_output << "Too many identifiers" << endl;
+		m_buffer << "Too many identifiers" << '\n';
 		return false;
 	}
 	if (!IsValidIdentifier(variableName))
 	{
-		m_output << "Not valid identifier name" << endl;
+		m_buffer << "Not valid identifier name" << '\n';
 		return false;
 	}
-	if (!m_calc.AddVariable(variableName))
+	bool isDeclared = m_batch
+		? m_calc.Find(variableName) || !m_batch->emplace(variableName, nullopt).second
+		: !m_calc.AddVariable(variableName);
+	if (isDeclared)
 	{
-		m_output << "Variable already exist" << endl;
+		m_buffer << "Variable already exist" << '\n';
 		return false;
 	}
 	return true;
 }
 
-bool CControl::IsValidIdentifier(const string& identifierName)
+bool CControl::IsValidIdentifier(string_view identifierName)
+{
+	return IsValidIdentifierName(identifierName);
+}
+
+bool CControl::ParseCommandAndArgsForAddVariable(string_view variable, const Token& value)
 {
-	const regex pattern(R"d(^[a-zA-Z_][a-zA-Z0-9_]*$)d");
-	if (regex_match(identifierName, pattern))
+	if (auto id = m_calc.Find(variable); id && m_calc.GetType(*id) == IdentifierType::FUNCTION)
 	{
-		return true;
+		m_buffer << "Cannot assign value to function" << '\n';
+		return false;
+	}
+	if (m_batch)
+	{
+		return AssignValueInBatch(variable, value);
+	}
+	if (value.type == TokenType::NUMBER)
+	{
+		return m_calc.AddVariableWithValue(variable, value.text);
+	}
+	if (!m_calc.AddVariableWithOtherVariableValue(variable, value.text))
+	{
+		m_buffer << "Assignment not possible" << '\n';
+		return false;
+	}
+	return true;
+}
+
+// a batch reads its own pending values first, then the calculator
+bool CControl::AssignValueInBatch(string_view variable, const Token& value)
+{
+	double number = NAN;
+	if (value.type == TokenType::NUMBER)
+	{
+		number = ParseNumber(value.text, NumberExtent::PREFIX).value_or(NAN);
+	}
+	else if (auto pending = m_batch->find(value.text); pending != m_batch->end())
+	{
+		number = pending->second.value_or(NAN);
 	}
-	return false;
+	else if (auto id = m_calc.Find(value.text); id && m_calc.GetType(*id) == IdentifierType::VARIABLE)
+	{
+		number = m_calc.GetValue(*id);
+	}
+	else
+	{
+		m_buffer << "Assignment not possible" << '\n';
+		return false;
+	}
+	m_batch->insert_or_assign(string(variable), number);
+	return true;
 }
 
-bool CControl::ParseCommandAndArgsForAddVariable(smatch& submatch)
+// <identifier>=<identifier> or <identifier>=[+-]<number>, the value token spans the sign
+optional<pair<string_view, Token>> ParseAssignment(string_view assignment)
 {
-	if (m_calc.GetIdentifierType(submatch[1]).has_value())
+	CLexer lexer(assignment);
+	Token name = lexer.NextToken();
+	if (name.type != TokenType::IDENTIFIER || !lexer.NextToken().IsSymbol('='))
 	{
-		if (m_calc.GetIdentifierType(submatch[1]) == IdentifierType::FUNCTION)
+		return nullopt;
+	}
+	Token value = lexer.NextToken();
+	if (value.IsSymbol('+') || value.IsSymbol('-'))
+	{
+		Token number = lexer.NextToken();
+		if (number.type != TokenType::NUMBER)
 		{
-			m_output << "Cannot assign value to function" << endl;
-			return false;
+			return nullopt;
 		}
+		value.type = TokenType::NUMBER;
+		value.text = string_view(value.text.data(), number.text.data() + number.text.size() - value.text.data());
+	}
+	if ((value.type != TokenType::NUMBER && value.type != TokenType::IDENTIFIER) || !lexer.IsAtEnd())
+	{
+		return nullopt;
 	}
-	if (submatch[2].matched)
+	return make_pair(name.text, value);
+}
+
+bool CControl::AssignValueToVariable(string_view args)
+{
+	CLexer lexer(args);
+	string_view assignment = lexer.NextWord();
+	if (!lexer.IsAtEnd())
 	{
-		return m_calc.AddVariableWithValue(submatch[1], submatch[2]);
+		m_buffer << "Not valid expression" << '\n';
+		return false;
 	}
-	if (!m_calc.AddVariableWithOtherVariableValue(submatch[1], submatch[4]))
+	auto parsed = ParseAssignment(assignment);
+	if (!parsed)
 	{
-		m_output << "Assignment not possible" << endl;
+		m_buffer << "Not valid expression" << '\n';
 		return false;
 	}
+	return ParseCommandAndArgsForAddVariable(parsed->first, parsed->second);
+}
+
+bool CControl::PrintValue(string_view args) const
+{
+	CLexer lexer(args);
+	string_view identifier = lexer.NextWord();
+	auto id = m_calc.Find(identifier);
+	if (!id)
+	{
+		m_buffer << "Variable not exist" << '\n';
+		return false;
+	}
+	double value = m_calc.GetValue(*id);
+	if (m_calc.GetType(*id) == IdentifierType::VARIABLE)
+	{
+		if (isinf(value))
+		{
+			m_buffer << "Variable not exist" << '\n';
+			return false;
+		}
+		m_buffer << value << '\n';
+		return true;
+	}
+	m_buffer << fixed << setprecision(2) << value << '\n';
+	return true;
+}
+
+bool CControl::PrintVars(string_view args) const
+{
+	PrintIdentifiers(IdentifierType::VARIABLE);
+	return true;
+}
+
+bool CControl::PrintFunctions(string_view args) const
+{
+	m_calc.EvaluateAllFunctions();
+	PrintIdentifiers(IdentifierType::FUNCTION);
 	return true;
 }
 
-bool CControl::AssignValueToVariable(istream& inpStrm)
+// <name>:<value with 2 decimals> per line, same text as fixed << setprecision(2)
+void CControl::PrintIdentifiers(IdentifierType type) const
+{
+	auto ids = m_calc.GetSortedIds(type);
+	if (!ids.empty())
+	{
+		// print of a variable has always shown 2 decimals after a listing
+		m_buffer << fixed << setprecision(2);
+	}
+	string listing;
+	listing.reserve(OUTPUT_FLUSH_THRESHOLD + MAX_VALUE_TEXT_SIZE);
+	for (IdentifierId id: ids)
+	{
+		string_view name = m_calc.GetName(id);
+		char value[MAX_VALUE_TEXT_SIZE];
+		char* valueEnd = to_chars(value, value + sizeof(value), m_calc.GetValue(id), chars_format::fixed, 2).ptr;
+		listing.append(name).append(1, ':').append(value, valueEnd).append(1, '\n');
+		if (listing.size() >= OUTPUT_FLUSH_THRESHOLD)
+		{
+			m_buffer.write(listing.data(), static_cast<streamsize>(listing.size()));
+			listing.clear();
+		}
+	}
+	m_buffer.write(listing.data(), static_cast<streamsize>(listing.size()));
+}
+
+// sweep <function> <variable> <from> <to> <step>
+bool CControl::SweepFunction(string_view args) const
 {
-	string assignment;
-	inpStrm >> assignment;
-	if (!IsRestOfCommandEmpty(inpStrm))
+	CLexer lexer(args);
+	string_view functionName = lexer.NextWord();
+	string_view variableName = lexer.NextWord();
+	auto from = ParseNumber(lexer.NextWord());
+	auto to = ParseNumber(lexer.NextWord());
+	auto step = ParseNumber(lexer.NextWord());
+	if (!from || !to || !step || !(*step > 0) || !lexer.IsAtEnd())
+	{
+		m_buffer << "Not valid expression" << '\n';
+		return false;
+	}
+	if (m_calc.GetIdentifierType(functionName) != IdentifierType::FUNCTION
+		|| m_calc.GetIdentifierType(variableName) != IdentifierType::VARIABLE)
 	{
-		m_output << "Not valid expression" << endl;
+		m_buffer << "Identifier not exist" << '\n';
 		return false;
 	}
-	regex rgx(
-//		"^([a-zA-Z_][a-zA-Z0-9_]*)=(?:(-?[0-9][0-9.]*)|([a-zA-Z_][a-zA-Z0-9_]*))$" // без возможности чтения эксп записи
-		"^([a-zA-Z_][a-zA-Z0-9_]*)=(?:([+-]?[0-9][0-9.]*([eE][0-9]*)?)|([a-zA-Z_][a-zA-Z0-9_]*))$"
-		);
-	smatch submatch;
-	if (!regex_match(assignment, submatch, rgx))
+	// tolerance keeps the end of the range when the step is not exact in binary
+	double steps = (*to - *from) / *step + 1e-9;
+	if (!(*to >= *from) || !(steps < MAX_SWEEP_VALUE_COUNT))
 	{
-		m_output << "Not valid expression" << endl;
+		m_buffer << "Not valid expression" << '\n';
 		return false;
 	}
-	return ParseCommandAndArgsForAddVariable(submatch);
+	auto count = static_cast<size_t>(steps) + 1;
+	vector<double> values;
+	values.reserve(count);
+	for (size_t i = 0; i < count; ++i)
+	{
+		values.push_back(*from + static_cast<double>(i) * *step);
+	}
+	for (double result: m_calc.Sweep(functionName, variableName, values))
+	{
+		m_buffer << fixed << setprecision(2) << result << '\n';
+	}
+	return true;
 }
 
-bool CControl::PrintValue(istream& inpStrm) const
+// import <path to name,value csv>
+bool CControl::ImportVariables(string_view args)
 {
-	string identifier;
-	inpStrm >> identifier;
-	if (!m_calc.GetIdentifierType(identifier).has_value())
+	CLexer lexer(args);
+	string_view path = lexer.NextWord();
+	if (path.empty() || !lexer.IsAtEnd())
 	{
-		m_output << "Variable not exist" << endl;
+		m_buffer << "Not valid expression" << '\n';
 		return false;
 	}
-	if (m_calc.GetIdentifierType(identifier) == IdentifierType::VARIABLE)
+	if (!m_batch)
 	{
-		double value = m_calc.GetVariableValueByName(identifier);
-		if (isinf(value))
+		if (!m_calc.ImportVariablesFromFile(string(path)))
 		{
-			m_output << "Variable not exist" << endl;
+			m_buffer << "Import not possible" << '\n';
 			return false;
 		}
-		m_output << value << endl;
 		return true;
 	}
-	double value = m_calc.GetFunctionValue(identifier);
-	m_output << fixed << setprecision(2) << value << endl;
+	CMappedFile file;
+	auto rows = file.Open(string(path)) ? CCalculator::ParseVariables(file.GetData()) : nullopt;
+	if (!rows || any_of(rows->begin(), rows->end(), [this](const auto& row) {
+			return m_calc.GetIdentifierType(row.first) == IdentifierType::FUNCTION;
+		}))
+	{
+		m_buffer << "Import not possible" << '\n';
+		return false;
+	}
+	for (const auto& [name, value]: *rows)
+	{
+		m_batch->insert_or_assign(string(name), value);
+	}
+	return true;
+}
+
+bool CControl::BeginBatch(string_view args)
+{
+	if (m_batch)
+	{
+		m_buffer << "Batch already open" << '\n';
+		return false;
+	}
+	m_batch.emplace();
 	return true;
 }
 
-bool CControl::PrintVars(istream& inpStrm) const
+// commit applies every buffered value at once, a name declared var only in the batch
+// is added if it still does not exist
+bool CControl::EndBatch(string_view args, bool commit)
 {
-	auto& allVariables = m_calc.GetAllVariables();
-	if (allVariables.size() > 0)
+	if (!m_batch)
 	{
-		for (auto item: allVariables)
+		m_buffer << "No open batch" << '\n';
+		return false;
+	}
+	VariableBatch batch = std::move(*m_batch);
+	m_batch.reset();
+	if (!commit)
+	{
+		return true;
+	}
+	vector<pair<string_view, double>> values;
+	values.reserve(batch.size());
+	for (const auto& [name, value]: batch)
+	{
+		if (value || !m_calc.Find(name))
 		{
-			if (item.identifierType == IdentifierType::VARIABLE)
-			{
-				m_output << item.identifierName << ":"
-						 << fixed << setprecision(2)
-						 << m_calc.GetVariableValueByName(item.identifierName) << endl;
-			}
+			values.emplace_back(name, value.value_or(NAN));
 		}
 	}
+	if (!m_calc.AssignVariables(values))
+	{
+		m_buffer << "Cannot assign value to function" << '\n';
+		return false;
+	}
+	return true;
+}
+
+// reactive on|off
+bool CControl::SetReactive(string_view args)
+{
+	CLexer lexer(args);
+	string_view mode = lexer.NextWord();
+	if ((mode != "on" && mode != "off") || !lexer.IsAtEnd())
+	{
+		m_buffer << "Not valid expression" << '\n';
+		return false;
+	}
+	m_calc.SetReactive(mode == "on");
+	return true;
+}
+
+bool CControl::PrintChanges(string_view args)
+{
+	for (const auto& change: m_calc.TakeChanges())
+	{
+		m_buffer << change.functionName << " changed from "
+				 << fixed << setprecision(2) << change.oldValue << " to " << change.newValue << '\n';
+	}
 	return true;
 }
 
-bool CControl::PrintFunctions(std::istream& inpStrm) const
+// stats on|off|reset, without arguments prints what was collected:
+// <action>:<count> calls, <failures> failed, avg <microseconds> us, then <bound>us:<count> for every used bucket
+bool CControl::Stats(string_view args)
 {
-	auto& allVariables = m_calc.GetAllVariables();
-	if (allVariables.size() > 0)
+	CLexer lexer(args);
+	string_view mode = lexer.NextWord();
+	if (!lexer.IsAtEnd() || (!mode.empty() && mode != "on" && mode != "off" && mode != "reset"))
+	{
+		m_buffer << "Not valid expression" << '\n';
+		return false;
+	}
+	if (mode == "on" || mode == "off")
+	{
+		SetStatsEnabled(mode == "on");
+		return true;
+	}
+	if (mode == "reset")
+	{
+		m_commandStats.clear();
+		m_calc.ResetEvaluationStats();
+		return true;
+	}
+	for (const auto& [action, stats]: m_commandStats)
 	{
-		for (auto item: allVariables)
+		m_buffer << action << ":" << stats.count << " calls, " << stats.failures << " failed, avg "
+				 << fixed << setprecision(2)
+				 << chrono::duration<double, micro>(stats.totalTime).count() / static_cast<double>(stats.count) << " us";
+		for (size_t i = 0; i < stats.latencyBuckets.size(); ++i)
 		{
-			if (item.identifierType == IdentifierType::FUNCTION)
+			if (stats.latencyBuckets[i] == 0)
 			{
-				m_output << item.identifierName << ":"
-						 << fixed << setprecision(2)
-						 << m_calc.GetFunctionValue(item.identifierName) << endl;
+				continue;
+			}
+			if (i + 1 == stats.latencyBuckets.size())
+			{
+				m_buffer << " >=" << (uint64_t(1) << (i - 1)) << "us:" << stats.latencyBuckets[i];
+			}
+			else
+			{
+				m_buffer << " <" << (uint64_t(1) << i) << "us:" << stats.latencyBuckets[i];
 			}
 		}
+		m_buffer << '\n';
 	}
+	const EvaluationStats& evaluation = m_calc.GetEvaluationStats();
+	m_buffer << "eval:" << evaluation.nodeVisits << " visits, " << evaluation.cacheHits << " cache hits, "
+			 << evaluation.maxDepth << " max depth" << '\n';
 	return true;
 }
 
-bool CControl::DeclareFunction(istream& inpStrm)
+// <identifier>=<expression>
+optional<pair<string_view, string_view>> ParseFunctionDeclaration(string_view declaration)
 {
-	string funcDeclaration;
-	inpStrm >> funcDeclaration;
-	if (!IsRestOfCommandEmpty(inpStrm))
+	CLexer lexer(declaration);
+	Token name = lexer.NextToken();
+	Token assignment = lexer.NextToken();
+	if (name.type != TokenType::IDENTIFIER || !assignment.IsSymbol('='))
 	{
-		m_output << "Not valid expression" << endl;
-		return false;
+		return nullopt;
 	}
-	regex rgx(
-		"^([a-zA-Z_][a-zA-Z0-9_]*)="
-		"(?:([a-zA-Z_][a-zA-Z0-9_]*)|([a-zA-Z_][a-zA-Z0-9_]*[+-/*][a-zA-Z_][a-zA-Z0-9_]*))$"
-		);
-	smatch submatch;
-	if (!regex_match(funcDeclaration, submatch, rgx))
+	// the expression is compiled by the calculator, once
+	return make_pair(name.text, declaration.substr(assignment.text.data() + 1 - declaration.data()));
+}
+
+bool CControl::DeclareFunction(string_view args)
+{
+	auto parsed = ParseFunctionDeclaration(args);
+	if (!parsed)
 	{
-		m_output << "Not valid expression" << endl;
+		m_buffer << "Not valid expression" << '\n';
 		return false;
 	}
-	return ParseCommandAndArgsForAddFunction(submatch);
+	return ParseCommandAndArgsForAddFunction(parsed->first, parsed->second);
 }
 
-bool CControl::ParseCommandAndArgsForAddFunction(const smatch& submatch)
+bool CControl::ParseCommandAndArgsForAddFunction(string_view functionName, string_view functionBody)
 {
-	auto allIdentifiers = m_calc.GetAllVariables();
-	Identifier identifierToAdd;
-	identifierToAdd.identifierName = submatch[1];
-	auto identToAdd = allIdentifiers.find(identifierToAdd);
-	if (identToAdd != allIdentifiers.end())
+	if (m_calc.Find(functionName) || (m_batch && m_batch->contains(functionName)))
 	{
-		m_output << "Identifier already exist" << endl;
+		m_buffer << "Identifier already exist" << '\n';
 		return false;
 	}
-	Identifier identifierToFind;
-	if (submatch[2].matched)
+	CLexer lexer(functionBody);
+	if (Token variable = lexer.NextToken(); variable.type == TokenType::IDENTIFIER && lexer.IsAtEnd())
 	{
-		identifierToFind.identifierName = submatch[2];
-		auto identToFind = allIdentifiers.find(identifierToFind);
-		if (identToFind == allIdentifiers.end())
+		if (!m_calc.Find(variable.text))
 		{
-			m_output << "Identifier not exist" << endl;
+			m_buffer << "Identifier not exist" << '\n';
 			return false;
 		}
-		identifierToAdd.identifierValue = identToFind->identifierValue;
-		if (!m_calc.AddFunctionWithVariable(identifierToAdd.identifierName,
-				identifierToFind.identifierName))
+		if (!m_calc.AddFunctionWithVariable(functionName, variable.text))
 		{
-			m_output << "Not possible to add function" << endl;
+			m_buffer << "Not possible to add function" << '\n';
 			return false;
 		}
 		return true;
 	}
-	m_calc.AddFunctionWithOperation(identifierToAdd.identifierName, submatch[3]);
+	if (!m_calc.AddFunctionWithOperation(functionName, functionBody))
+	{
+		m_buffer << "Not valid expression" << '\n';
+		return false;
+	}
 	return true;
 }
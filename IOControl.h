@@ -2,38 +2,99 @@
 #define CALCULATOR_IOCONTROL_H
 
 #include "Calculator.h"
+#include "Lexer.h"
+#include <array>
+#include <chrono>
+#include <functional>
 #include <map>
-#include <regex>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <string_view>
+
+struct CommandStats
+{
+	static constexpr size_t LATENCY_BUCKET_COUNT = 21;
+
+	size_t count = 0;
+	size_t failures = 0;
+	std::chrono::nanoseconds totalTime{};
+	// bucket 0 counts commands under 1 us, bucket i those in [2^(i-1), 2^i) us, the last one the rest
+	std::array<size_t, LATENCY_BUCKET_COUNT> latencyBuckets{};
+};
+
+using CommandStatsMap = std::map<std::string, CommandStats, std::less<>>;
 
 class CControl
 {
 public:
     CControl(CCalculator& calc, std::istream& input, std::ostream& output);
 	bool HandleCommand();
+	// executes every command up to the end of input, output is flushed in large blocks
+	void RunScript();
+	// same for a script that is already in memory, lines are not copied
+	void RunScript(std::string_view script);
+	// executes complete lines only and returns the length consumed, for input that arrives in pieces
+	size_t RunLines(std::string_view text);
+
+	// per-command counters and latency histograms, evaluation stats of the calculator are switched along
+	void SetStatsEnabled(bool enabled);
+	[[nodiscard]] const CommandStatsMap& GetCommandStats() const;
 
 	CControl& operator=(const CControl&) = delete;
 private:
-	bool DeclareVariable(std::istream& inpStrm);
+	static constexpr size_t INPUT_CHUNK_SIZE = 1 << 20;
+	static constexpr size_t OUTPUT_FLUSH_THRESHOLD = 1 << 16;
+	// room for any double printed with 2 decimals
+	static constexpr size_t MAX_VALUE_TEXT_SIZE = 512;
+	// a sweep keeps every value and result in memory
+	static constexpr double MAX_SWEEP_VALUE_COUNT = 1 << 24;
+
+	bool ExecuteCommand(std::string_view commandLine);
+	// executes complete lines, returns the length of text consumed
+	size_t ExecuteLines(std::string_view text);
+	void FlushOutput();
+
+	bool DeclareVariable(std::string_view args);
+
+	bool ParseCommandAndArgsForAddVariable(std::string_view variable, const Token& value);
+	bool AssignValueInBatch(std::string_view variable, const Token& value);
+	bool AssignValueToVariable(std::string_view args);
+	static bool IsValidIdentifier(std::string_view identifierName);
 
-	bool ParseCommandAndArgsForAddVariable(std::smatch& submatch);
-	bool AssignValueToVariable(std::istream& inpStrm);
-	static bool IsValidIdentifier(const std::string& identifierName);
+	bool PrintValue(std::string_view args) const;
+	bool PrintVars(std::string_view args) const;
+	bool PrintFunctions(std::string_view args) const;
+	void PrintIdentifiers(IdentifierType type) const;
+	bool SweepFunction(std::string_view args) const;
+	bool SetReactive(std::string_view args);
+	bool PrintChanges(std::string_view args);
+	bool Stats(std::string_view args);
+	void RecordCommand(std::string_view action, bool succeeded, std::chrono::nanoseconds time);
 
-	bool PrintValue(std::istream& inpStrm) const;
-	bool PrintVars(std::istream& inpStrm) const;
-	bool PrintFunctions(std::istream& inpStrm) const;
+	bool ImportVariables(std::string_view args);
+	bool BeginBatch(std::string_view args);
+	bool EndBatch(std::string_view args, bool commit);
 
-	bool DeclareFunction(std::istream& inpStrm);
-	bool ParseCommandAndArgsForAddFunction(const std::smatch& submatch);
+	bool DeclareFunction(std::string_view args);
+	bool ParseCommandAndArgsForAddFunction(std::string_view functionName, std::string_view functionBody);
 
-    using Handler = std::function<bool(std::istream& args)>;
-	using ActionMap = std::map<std::string, Handler>;
+    using Handler = std::function<bool(std::string_view args)>;
+	using ActionMap = std::map<std::string, Handler, std::less<>>;
 
 	CCalculator& m_calc;
 	std::istream& m_input;
 	std::ostream& m_output;
+	mutable std::ostringstream m_buffer;
+	std::string m_commandLine;
 
 	const ActionMap m_actionMap;
+	bool m_statsEnabled = false;
+	CommandStatsMap m_commandStats;
+	// var, let and import between begin and commit, kept per connection so that clients sharing
+	// a calculator never see each other's batch; var alone buffers no value
+	using VariableBatch = std::map<std::string, std::optional<double>, std::less<>>;
+	std::optional<VariableBatch> m_batch;
 };
 
 #endif // CALCULATOR_IOCONTROL_H
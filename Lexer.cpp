@@ -0,0 +1,126 @@
+#include "Lexer.h"
+#include <charconv>
+
+using namespace std;
+
+namespace
+{
+bool IsSpace(char ch)
+{
+	return ch == ' ' || ch == '\t' || ch == '\n' || ch == '\v' || ch == '\f' || ch == '\r';
+}
+
+bool IsDigit(char ch)
+{
+	return ch >= '0' && ch <= '9';
+}
+
+bool IsIdentifierStart(char ch)
+{
+	return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') || ch == '_';
+}
+
+bool IsIdentifierChar(char ch)
+{
+	return IsIdentifierStart(ch) || IsDigit(ch);
+}
+} // namespace
+
+CLexer::CLexer(string_view text)
+	: m_text(text)
+{}
+
+void CLexer::SkipSpaces()
+{
+	while (m_pos < m_text.size() && IsSpace(m_text[m_pos]))
+	{
+		++m_pos;
+	}
+}
+
+string_view CLexer::NextWord()
+{
+	SkipSpaces();
+	size_t start = m_pos;
+	while (m_pos < m_text.size() && !IsSpace(m_text[m_pos]))
+	{
+		++m_pos;
+	}
+	return m_text.substr(start, m_pos - start);
+}
+
+Token CLexer::NextToken()
+{
+	SkipSpaces();
+	if (m_pos == m_text.size())
+	{
+		return { TokenType::END, {} };
+	}
+	size_t start = m_pos;
+	char ch = m_text[m_pos++];
+	if (IsIdentifierStart(ch))
+	{
+		while (m_pos < m_text.size() && IsIdentifierChar(m_text[m_pos]))
+		{
+			++m_pos;
+		}
+		return { TokenType::IDENTIFIER, m_text.substr(start, m_pos - start) };
+	}
+	if (IsDigit(ch))
+	{
+		while (m_pos < m_text.size() && (IsDigit(m_text[m_pos]) || m_text[m_pos] == '.'))
+		{
+			++m_pos;
+		}
+		if (m_pos < m_text.size() && (m_text[m_pos] == 'e' || m_text[m_pos] == 'E'))
+		{
+			++m_pos;
+			while (m_pos < m_text.size() && IsDigit(m_text[m_pos]))
+			{
+				++m_pos;
+			}
+		}
+		return { TokenType::NUMBER, m_text.substr(start, m_pos - start) };
+	}
+	return { TokenType::SYMBOL, m_text.substr(start, 1) };
+}
+
+Token CLexer::PeekToken()
+{
+	size_t pos = m_pos;
+	Token token = NextToken();
+	m_pos = pos;
+	return token;
+}
+
+bool CLexer::IsAtEnd()
+{
+	SkipSpaces();
+	return m_pos == m_text.size();
+}
+
+bool IsValidIdentifierName(string_view name)
+{
+	CLexer lexer(name);
+	Token token = lexer.NextToken();
+	return token.type == TokenType::IDENTIFIER && token.text.size() == name.size();
+}
+
+optional<double> ParseNumber(string_view text, NumberExtent extent)
+{
+	if (!text.empty() && text.front() == '+')
+	{
+		text.remove_prefix(1);
+		if (!text.empty() && text.front() == '-')
+		{
+			return nullopt;
+		}
+	}
+	double value;
+	auto [end, ec] = from_chars(text.data(), text.data() + text.size(), value);
+	if (ec != errc() || (extent == NumberExtent::WHOLE_TEXT && end != text.data() + text.size()))
+	{
+		return nullopt;
+	}
+	return value;
+}
@@ -0,0 +1,56 @@
+#ifndef CALCULATOR_LEXER_H
+#define CALCULATOR_LEXER_H
+
+#include <optional>
+#include <string_view>
+
+enum class TokenType
+{
+	IDENTIFIER,
+	NUMBER,
+	SYMBOL,
+	END
+};
+
+struct Token
+{
+	TokenType type;
+	std::string_view text;
+
+	bool IsSymbol(char symbol) const
+	{
+		return type == TokenType::SYMBOL && text.front() == symbol;
+	}
+};
+
+// Splits a command line without copying it: words are whitespace-delimited,
+// tokens are identifiers, numbers ([0-9][0-9.]*([eE][0-9]*)?) and single symbols
+class CLexer
+{
+public:
+	explicit CLexer(std::string_view text);
+
+	std::string_view NextWord();
+	Token NextToken();
+	Token PeekToken();
+	[[nodiscard]] bool IsAtEnd();
+
+private:
+	void SkipSpaces();
+
+	std::string_view m_text;
+	size_t m_pos = 0;
+};
+
+bool IsValidIdentifierName(std::string_view name);
+enum class NumberExtent
+{
+	WHOLE_TEXT,
+	// characters after the number are ignored, let has always read 1.5.3 as 1.5
+	PREFIX
+};
+
+// an optional sign is accepted
+std::optional<double> ParseNumber(std::string_view text, NumberExtent extent = NumberExtent::WHOLE_TEXT);
+
+#endif // CALCULATOR_LEXER_H
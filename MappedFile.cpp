@@ -0,0 +1,57 @@
+#include "MappedFile.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+CMappedFile::~CMappedFile()
+{
+	Close();
+}
+
+bool CMappedFile::Open(const std::string& path)
+{
+	Close();
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd == -1)
+	{
+		return false;
+	}
+	struct stat fileStat {};
+	if (fstat(fd, &fileStat) == -1)
+	{
+		close(fd);
+		return false;
+	}
+	size_t size = static_cast<size_t>(fileStat.st_size);
+	if (size == 0)
+	{
+		close(fd);
+		return true;
+	}
+	void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+	{
+		return false;
+	}
+	madvise(data, size, MADV_SEQUENTIAL);
+	m_data = data;
+	m_size = size;
+	return true;
+}
+
+void CMappedFile::Close()
+{
+	if (m_data != nullptr)
+	{
+		munmap(m_data, m_size);
+	}
+	m_data = nullptr;
+	m_size = 0;
+}
+
+std::string_view CMappedFile::GetData() const
+{
+	return { static_cast<const char*>(m_data), m_size };
+}
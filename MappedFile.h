@@ -0,0 +1,26 @@
+#ifndef CALCULATOR_MAPPEDFILE_H
+#define CALCULATOR_MAPPEDFILE_H
+
+#include <string>
+#include <string_view>
+
+// Read-only memory mapping of a whole file
+class CMappedFile
+{
+public:
+	CMappedFile() = default;
+	~CMappedFile();
+
+	CMappedFile(const CMappedFile&) = delete;
+	CMappedFile& operator=(const CMappedFile&) = delete;
+
+	bool Open(const std::string& path);
+	void Close();
+	[[nodiscard]] std::string_view GetData() const;
+
+private:
+	void* m_data = nullptr;
+	size_t m_size = 0;
+};
+
+#endif // CALCULATOR_MAPPEDFILE_H
@@ -0,0 +1,245 @@
+#include "Server.h"
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+CServer::CServer(CCalculator& calc)
+	: m_calc(calc)
+{}
+
+CServer::~CServer()
+{
+	Close();
+}
+
+bool CServer::Listen(const std::string& path)
+{
+	Close();
+	sockaddr_un address{};
+	address.sun_family = AF_UNIX;
+	if (path.empty() || path.size() >= sizeof(address.sun_path))
+	{
+		return false;
+	}
+	std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+	unlink(path.c_str());
+
+	m_listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	m_epollFd = epoll_create1(EPOLL_CLOEXEC);
+	m_stopFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (m_listenFd == -1 || m_epollFd == -1 || m_stopFd == -1
+		|| bind(m_listenFd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == -1)
+	{
+		Close();
+		return false;
+	}
+	m_path = path;
+	epoll_event listenEvent{ .events = EPOLLIN, .data = { .fd = m_listenFd } };
+	epoll_event stopEvent{ .events = EPOLLIN, .data = { .fd = m_stopFd } };
+	if (listen(m_listenFd, SOMAXCONN) == -1
+		|| epoll_ctl(m_epollFd, EPOLL_CTL_ADD, m_listenFd, &listenEvent) == -1
+		|| epoll_ctl(m_epollFd, EPOLL_CTL_ADD, m_stopFd, &stopEvent) == -1)
+	{
+		Close();
+		return false;
+	}
+	return true;
+}
+
+bool CServer::Run()
+{
+	if (m_epollFd == -1)
+	{
+		return false;
+	}
+	epoll_event events[MAX_EVENTS];
+	while (true)
+	{
+		int count = epoll_wait(m_epollFd, events, MAX_EVENTS, -1);
+		if (count == -1)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			return false;
+		}
+		for (int i = 0; i < count; ++i)
+		{
+			int fd = events[i].data.fd;
+			if (fd == m_stopFd)
+			{
+				uint64_t value;
+				read(m_stopFd, &value, sizeof(value));
+				return true;
+			}
+			if (fd == m_listenFd)
+			{
+				AcceptConnections();
+				continue;
+			}
+			auto it = m_connections.find(fd);
+			if (it == m_connections.end())
+			{
+				continue;
+			}
+			Connection& connection = *it->second;
+			if (events[i].events & EPOLLOUT)
+			{
+				WriteToConnection(connection);
+			}
+			else if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+			{
+				ReadFromConnection(connection);
+			}
+		}
+	}
+}
+
+void CServer::Stop()
+{
+	uint64_t value = 1;
+	write(m_stopFd, &value, sizeof(value));
+}
+
+void CServer::AcceptConnections()
+{
+	int fd;
+	while ((fd = accept4(m_listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1)
+	{
+		epoll_event event{ .events = EPOLLIN, .data = { .fd = fd } };
+		if (epoll_ctl(m_epollFd, EPOLL_CTL_ADD, fd, &event) == -1)
+		{
+			close(fd);
+			continue;
+		}
+		m_connections.emplace(fd, std::make_unique<Connection>(fd, m_calc));
+	}
+}
+
+void CServer::ReadFromConnection(Connection& connection)
+{
+	char chunk[READ_CHUNK_SIZE];
+	ssize_t size = recv(connection.fd, chunk, sizeof(chunk), 0);
+	if (size == -1 && (errno == EAGAIN || errno == EINTR))
+	{
+		return;
+	}
+	std::string& input = connection.pendingInput;
+	if (size > 0)
+	{
+		input.append(chunk, static_cast<size_t>(size));
+		// text before the chunk holds no newline, so a long line is not scanned again for every chunk
+		if (std::memchr(chunk, '\n', static_cast<size_t>(size)))
+		{
+			connection.inputOffset += connection.control.RunLines(std::string_view(input).substr(connection.inputOffset));
+		}
+		if (input.size() - connection.inputOffset > MAX_LINE_LENGTH)
+		{
+			input.clear();
+			connection.inputOffset = 0;
+			connection.output << "Line too long" << '\n';
+			connection.isClosing = true;
+		}
+		Compact(input, connection.inputOffset);
+	}
+	else
+	{
+		// the client is done sending, its last line may lack a newline
+		if (connection.inputOffset < input.size())
+		{
+			connection.control.RunScript(std::string_view(input).substr(connection.inputOffset));
+		}
+		input.clear();
+		connection.inputOffset = 0;
+		connection.isClosing = true;
+	}
+	connection.pendingOutput.append(connection.output.view());
+	connection.output.str(std::string());
+	WriteToConnection(connection);
+}
+
+void CServer::WriteToConnection(Connection& connection)
+{
+	std::string& output = connection.pendingOutput;
+	while (connection.outputOffset < output.size())
+	{
+		ssize_t size = send(connection.fd, output.data() + connection.outputOffset, output.size() - connection.outputOffset,
+			MSG_NOSIGNAL);
+		if (size == -1)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			if (errno != EAGAIN)
+			{
+				CloseConnection(connection.fd);
+				return;
+			}
+			break;
+		}
+		connection.outputOffset += static_cast<size_t>(size);
+	}
+	Compact(output, connection.outputOffset);
+	if (connection.isClosing && output.empty())
+	{
+		CloseConnection(connection.fd);
+		return;
+	}
+	UpdateInterest(connection);
+}
+
+void CServer::Compact(std::string& buffer, size_t& offset)
+{
+	if (offset == buffer.size())
+	{
+		buffer.clear();
+		offset = 0;
+	}
+	else if (offset > buffer.size() / 2)
+	{
+		buffer.erase(0, offset);
+		offset = 0;
+	}
+}
+
+void CServer::UpdateInterest(Connection& connection)
+{
+	epoll_event event{ .events = static_cast<uint32_t>(connection.pendingOutput.empty() ? EPOLLIN : EPOLLOUT),
+		.data = { .fd = connection.fd } };
+	epoll_ctl(m_epollFd, EPOLL_CTL_MOD, connection.fd, &event);
+}
+
+void CServer::CloseConnection(int fd)
+{
+	epoll_ctl(m_epollFd, EPOLL_CTL_DEL, fd, nullptr);
+	close(fd);
+	m_connections.erase(fd);
+}
+
+void CServer::Close()
+{
+	while (!m_connections.empty())
+	{
+		CloseConnection(m_connections.begin()->first);
+	}
+	for (int* fd: { &m_listenFd, &m_epollFd, &m_stopFd })
+	{
+		if (*fd != -1)
+		{
+			close(*fd);
+			*fd = -1;
+		}
+	}
+	if (!m_path.empty())
+	{
+		unlink(m_path.c_str());
+		m_path.clear();
+	}
+}
@@ -0,0 +1,78 @@
+#ifndef CALCULATOR_SERVER_H
+#define CALCULATOR_SERVER_H
+
+#include "Calculator.h"
+#include "IOControl.h"
+#include <memory>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+
+// Serves one calculator to many clients over a Unix domain socket. Every connection
+// has its own CControl; commands are newline-terminated and may be pipelined, replies
+// come back in order. A single epoll loop handles all connections, so commands of
+// different clients never run concurrently. A connection sending a line longer than
+// MAX_LINE_LENGTH is closed.
+// Batches and command stats belong to the connection, a batch left open is dropped
+// with it. The calculator is global: reactive on|off, the change list drained by
+// changes and the evaluation stats switched by stats on|off and printed by stats are
+// shared by all clients.
+class CServer
+{
+public:
+	explicit CServer(CCalculator& calc);
+	~CServer();
+
+	CServer(const CServer&) = delete;
+	CServer& operator=(const CServer&) = delete;
+
+	// a stale socket file at path is replaced
+	bool Listen(const std::string& path);
+	// returns once Stop is called, false on an event loop error
+	bool Run();
+	// safe to call from another thread
+	void Stop();
+
+private:
+	static constexpr size_t READ_CHUNK_SIZE = 1 << 16;
+	static constexpr size_t MAX_LINE_LENGTH = 1 << 22;
+	static constexpr int MAX_EVENTS = 64;
+
+	struct Connection
+	{
+		Connection(int fd, CCalculator& calc)
+			: fd(fd)
+			, control(calc, input, output)
+		{}
+
+		int fd;
+		std::istringstream input;
+		std::ostringstream output;
+		CControl control;
+		// text before the offsets is already executed or sent
+		std::string pendingInput;
+		size_t inputOffset = 0;
+		std::string pendingOutput;
+		size_t outputOffset = 0;
+		bool isClosing = false;
+	};
+
+	void AcceptConnections();
+	void ReadFromConnection(Connection& connection);
+	void WriteToConnection(Connection& connection);
+	// waits for input while nothing is queued, otherwise only for the queue to drain
+	void UpdateInterest(Connection& connection);
+	// drops the consumed prefix once it is at least half of the buffer, so each byte is moved O(1) times
+	static void Compact(std::string& buffer, size_t& offset);
+	void CloseConnection(int fd);
+	void Close();
+
+	CCalculator& m_calc;
+	std::string m_path;
+	int m_listenFd = -1;
+	int m_epollFd = -1;
+	int m_stopFd = -1;
+	std::unordered_map<int, std::unique_ptr<Connection>> m_connections;
+};
+
+#endif // CALCULATOR_SERVER_H
@@ -0,0 +1,118 @@
+#include "SharedCalculator.h"
+#include <algorithm>
+#include <thread>
+
+using namespace std;
+
+CSharedCalculator::CSnapshot::CSnapshot(ReaderSlot& slot, const CCalculator* calculator)
+	: m_slot(slot)
+	, m_calculator(calculator)
+{
+}
+
+CSharedCalculator::CSnapshot::~CSnapshot()
+{
+	// every read of the version happens before a writer sees the slot free
+	m_slot.epoch.store(NOT_READING, memory_order_release);
+}
+
+const CCalculator& CSharedCalculator::CSnapshot::operator*() const
+{
+	return *m_calculator;
+}
+
+const CCalculator* CSharedCalculator::CSnapshot::operator->() const
+{
+	return m_calculator;
+}
+
+CSharedCalculator::CSharedCalculator()
+	: m_current(new CCalculator())
+{
+}
+
+CSharedCalculator::~CSharedCalculator()
+{
+	delete m_current.load(memory_order_relaxed);
+}
+
+CSharedCalculator::CSnapshot CSharedCalculator::GetSnapshot() const
+{
+	// threads start probing at different slots, so readers rarely touch the same one
+	thread_local const size_t firstSlot = hash<thread::id>()(this_thread::get_id());
+	for (size_t i = firstSlot;; ++i)
+	{
+		if (i != firstSlot && (i - firstSlot) % READER_SLOT_COUNT == 0)
+		{
+			this_thread::yield();
+		}
+		ReaderSlot& slot = m_readerSlots[i % READER_SLOT_COUNT];
+		uint64_t expected = NOT_READING;
+		if (slot.epoch.load(memory_order_relaxed) != NOT_READING
+			|| !slot.epoch.compare_exchange_strong(expected, m_epoch.load(memory_order_seq_cst), memory_order_seq_cst))
+		{
+			continue;
+		}
+		// a writer that replaces the version loaded here does so in the announced epoch or later,
+		// so it does not free the version while the slot holds that epoch
+		return CSnapshot(slot, m_current.load(memory_order_seq_cst));
+	}
+}
+
+double CSharedCalculator::GetVariableValueByName(string_view variableName) const
+{
+	return GetSnapshot()->GetVariableValueByName(variableName);
+}
+
+double CSharedCalculator::GetFunctionValue(string_view functionName) const
+{
+	return GetSnapshot()->GetFunctionValue(functionName);
+}
+
+bool CSharedCalculator::Update(const function<bool(CCalculator&)>& change)
+{
+	lock_guard lock(m_writeMutex);
+	const CCalculator* current = m_current.load(memory_order_relaxed);
+	unique_ptr<CCalculator> next = current->Clone();
+	if (!change(*next))
+	{
+		return false;
+	}
+	next->EvaluateAllFunctions();
+	// listings are sorted before publishing as well, GetSortedIds only writes when something is unsorted
+	for (IdentifierType type: { IdentifierType::VARIABLE, IdentifierType::FUNCTION })
+	{
+		static_cast<void>(next->GetSortedIds(type));
+	}
+	m_current.store(next.release(), memory_order_seq_cst);
+	m_retired.emplace_back(m_epoch.fetch_add(1, memory_order_seq_cst), current);
+	FreeRetired();
+	return true;
+}
+
+void CSharedCalculator::FreeRetired()
+{
+	// a reader that announced epoch e may hold any version replaced in epoch e or later
+	uint64_t oldestEpoch = NOT_READING;
+	for (const ReaderSlot& slot: m_readerSlots)
+	{
+		oldestEpoch = min(oldestEpoch, slot.epoch.load(memory_order_seq_cst));
+	}
+	erase_if(m_retired, [oldestEpoch](const auto& retired) {
+		return retired.first < oldestEpoch;
+	});
+}
+
+bool CSharedCalculator::AddVariableWithValue(string_view variable, string_view value)
+{
+	return Update([&](CCalculator& calc) {
+		return calc.AddVariableWithValue(variable, value);
+	});
+}
+
+bool CSharedCalculator::AddFunctionWithOperation(string_view functionName, string_view operation)
+{
+	return Update([&](CCalculator& calc) {
+		return calc.AddFunctionWithOperation(functionName, operation);
+	});
+}
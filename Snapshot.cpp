@@ -0,0 +1,241 @@
+#include "Calculator.h"
+#include "MappedFile.h"
+#include "Snapshot.h"
+#include <cstring>
+#include <fstream>
+
+using namespace std;
+
+namespace
+{
+constexpr size_t SECTION_ALIGNMENT = 8;
+
+size_t AlignSection(size_t size)
+{
+	return (size + SECTION_ALIGNMENT - 1) / SECTION_ALIGNMENT * SECTION_ALIGNMENT;
+}
+
+void WriteSection(ostream& output, const void* data, size_t size)
+{
+	static const char padding[SECTION_ALIGNMENT] = {};
+	output.write(static_cast<const char*>(data), static_cast<streamsize>(size));
+	output.write(padding, static_cast<streamsize>(AlignSection(size) - size));
+}
+
+template <typename T>
+void ReadArray(const char* source, size_t count, pmr::vector<T>& destination)
+{
+	destination.resize(count);
+	if (count != 0)
+	{
+		memcpy(destination.data(), source, count * sizeof(T));
+	}
+}
+
+// recomputes the stack depth so that a damaged file cannot make evaluation leave its stack
+bool CheckFunctionBody(FunctionBody& body, uint64_t identifierCount)
+{
+	size_t depth = 0;
+	body.stackSize = 0;
+	for (const Instruction& instruction: body.code)
+	{
+		switch (instruction.opCode)
+		{
+		case OpCode::PUSH_IDENTIFIER:
+			if (instruction.argument >= identifierCount)
+			{
+				return false;
+			}
+			body.stackSize = max(body.stackSize, ++depth);
+			break;
+		case OpCode::PUSH_CONSTANT:
+			if (instruction.argument >= body.constants.size())
+			{
+				return false;
+			}
+			body.stackSize = max(body.stackSize, ++depth);
+			break;
+		case OpCode::NEGATE:
+			if (depth < 1)
+			{
+				return false;
+			}
+			break;
+		case OpCode::APPLY:
+			if (depth < 2 || static_cast<uint8_t>(instruction.operation) >= OPERATION_COUNT)
+			{
+				return false;
+			}
+			--depth;
+			break;
+		default:
+			return false;
+		}
+	}
+	for (IdentifierId operand: body.operands)
+	{
+		if (operand >= identifierCount)
+		{
+			return false;
+		}
+	}
+	return body.code.empty() || depth == 1;
+}
+} // namespace
+
+bool CCalculator::SaveSnapshot(const string& path) const
+{
+	vector<SnapshotIdentifier> identifiers(m_names.size());
+	string names;
+	vector<Instruction> code;
+	vector<double> constants;
+	vector<uint64_t> operands;
+	const FunctionBody noBody;
+	for (IdentifierId id = 0; id < m_names.size(); ++id)
+	{
+		SnapshotIdentifier& identifier = identifiers[id];
+		const FunctionBody& body = m_types[id] == IdentifierType::FUNCTION ? GetBody(id) : noBody;
+		identifier.nameOffset = names.size();
+		identifier.nameSize = static_cast<uint32_t>(m_names[id].size());
+		identifier.type = !m_types[id] ? SnapshotIdentifierType::UNDECLARED
+			: m_types[id] == IdentifierType::VARIABLE ? SnapshotIdentifierType::VARIABLE
+													  : SnapshotIdentifierType::FUNCTION;
+		identifier.value = m_values[id];
+		identifier.codeOffset = code.size();
+		identifier.codeSize = static_cast<uint32_t>(body.code.size());
+		identifier.constantOffset = constants.size();
+		identifier.constantCount = static_cast<uint32_t>(body.constants.size());
+		identifier.operandOffset = operands.size();
+		identifier.operandCount = static_cast<uint32_t>(body.operands.size());
+		identifier.stackSize = static_cast<uint32_t>(body.stackSize);
+		names.append(m_names[id]);
+		// fields are copied one by one so that the padding of Instruction stays zero in the file
+		for (const Instruction& instruction: body.code)
+		{
+			Instruction& stored = code.emplace_back();
+			memset(static_cast<void*>(&stored), 0, sizeof(stored));
+			stored.opCode = instruction.opCode;
+			stored.operation = instruction.operation;
+			stored.argument = instruction.argument;
+		}
+		constants.insert(constants.end(), body.constants.begin(), body.constants.end());
+		operands.insert(operands.end(), body.operands.begin(), body.operands.end());
+	}
+
+	SnapshotHeader header{};
+	memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+	header.version = SNAPSHOT_VERSION;
+	header.byteOrderMark = SNAPSHOT_BYTE_ORDER_MARK;
+	header.identifierCount = identifiers.size();
+	header.namesSize = names.size();
+	header.instructionCount = code.size();
+	header.constantCount = constants.size();
+	header.operandCount = operands.size();
+
+	ofstream output(path, ios::binary | ios::trunc);
+	WriteSection(output, &header, sizeof(header));
+	WriteSection(output, names.data(), names.size());
+	WriteSection(output, identifiers.data(), identifiers.size() * sizeof(SnapshotIdentifier));
+	WriteSection(output, code.data(), code.size() * sizeof(Instruction));
+	WriteSection(output, constants.data(), constants.size() * sizeof(double));
+	WriteSection(output, operands.data(), operands.size() * sizeof(uint64_t));
+	output.flush();
+	return output.good();
+}
+
+bool CCalculator::LoadSnapshot(const string& path)
+{
+	CMappedFile file;
+	if (!file.Open(path))
+	{
+		return false;
+	}
+	Reset();
+	string_view data = file.GetData();
+	SnapshotHeader header;
+	if (data.size() < sizeof(header))
+	{
+		return false;
+	}
+	memcpy(&header, data.data(), sizeof(header));
+	if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0
+		|| header.version < SNAPSHOT_MIN_VERSION || header.version > SNAPSHOT_VERSION || header.byteOrderMark != SNAPSHOT_BYTE_ORDER_MARK)
+	{
+		return false;
+	}
+	// every count is bounded by the file size before any offset is computed from it
+	if (header.identifierCount > data.size() || header.namesSize > data.size() || header.instructionCount > data.size()
+		|| header.constantCount > data.size() || header.operandCount > data.size())
+	{
+		return false;
+	}
+	const size_t namesStart = sizeof(header);
+	const size_t identifiersStart = namesStart + AlignSection(header.namesSize);
+	const size_t codeStart = identifiersStart + AlignSection(header.identifierCount * sizeof(SnapshotIdentifier));
+	const size_t constantsStart = codeStart + AlignSection(header.instructionCount * sizeof(Instruction));
+	const size_t operandsStart = constantsStart + AlignSection(header.constantCount * sizeof(double));
+	const size_t end = operandsStart + header.operandCount * sizeof(uint64_t);
+	if (end > data.size())
+	{
+		return false;
+	}
+
+	for (uint64_t id = 0; id < header.identifierCount; ++id)
+	{
+		SnapshotIdentifier identifier;
+		memcpy(&identifier, data.data() + identifiersStart + id * sizeof(SnapshotIdentifier), sizeof(identifier));
+		if (identifier.nameOffset > header.namesSize || identifier.nameSize > header.namesSize - identifier.nameOffset
+			|| identifier.codeOffset > header.instructionCount || identifier.codeSize > header.instructionCount - identifier.codeOffset
+			|| identifier.constantOffset > header.constantCount || identifier.constantCount > header.constantCount - identifier.constantOffset
+			|| identifier.operandOffset > header.operandCount || identifier.operandCount > header.operandCount - identifier.operandOffset
+			|| identifier.type > SnapshotIdentifierType::FUNCTION)
+		{
+			Reset();
+			return false;
+		}
+		// names are unique, so interning in file order gives every identifier its stored id
+		if (Intern(data.substr(namesStart + identifier.nameOffset, identifier.nameSize)) != id)
+		{
+			Reset();
+			return false;
+		}
+		m_values[id] = identifier.value;
+		if (identifier.type == SnapshotIdentifierType::UNDECLARED)
+		{
+			continue;
+		}
+		if (identifier.type == SnapshotIdentifierType::VARIABLE)
+		{
+			Declare(id, IdentifierType::VARIABLE);
+			continue;
+		}
+		Declare(id, IdentifierType::FUNCTION);
+		FunctionBody& body = GetBody(id);
+		ReadArray(data.data() + codeStart + identifier.codeOffset * sizeof(Instruction), identifier.codeSize, body.code);
+		ReadArray(data.data() + constantsStart + identifier.constantOffset * sizeof(double), identifier.constantCount, body.constants);
+		body.operands.resize(identifier.operandCount);
+		for (uint32_t i = 0; i < identifier.operandCount; ++i)
+		{
+			uint64_t operand;
+			memcpy(&operand, data.data() + operandsStart + (identifier.operandOffset + i) * sizeof(uint64_t), sizeof(operand));
+			body.operands[i] = static_cast<IdentifierId>(operand);
+		}
+		if (!CheckFunctionBody(body, header.identifierCount))
+		{
+			Reset();
+			return false;
+		}
+	}
+	for (IdentifierId id = 0; id < m_names.size(); ++id)
+	{
+		if (m_types[id] == IdentifierType::FUNCTION)
+		{
+			AddDependency(GetBody(id), id);
+		}
+	}
+	if (m_reactive)
+	{
+		EvaluateAllFunctions();
+	}
+	return true;
+}
@@ -0,0 +1,55 @@
+#ifndef CALCULATOR_SNAPSHOT_H
+#define CALCULATOR_SNAPSHOT_H
+
+#include "Expression.h"
+#include <cstdint>
+
+// Binary snapshot of the symbol table, native byte order. Layout:
+// SnapshotHeader, names, SnapshotIdentifier[identifierCount], Instruction[instructionCount],
+// double[constantCount], uint64_t[operandCount]; every section starts at a multiple of 8
+constexpr char SNAPSHOT_MAGIC[8] = { 'C', 'A', 'L', 'C', 'S', 'N', 'A', 'P' };
+// version 1 stored fn <name>=<variable> as a copied value with no code, such functions
+// load frozen at that value; since version 2 they are stored as code reading the variable
+constexpr uint32_t SNAPSHOT_VERSION = 2;
+constexpr uint32_t SNAPSHOT_MIN_VERSION = 1;
+constexpr uint32_t SNAPSHOT_BYTE_ORDER_MARK = 0x01020304;
+
+struct SnapshotHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t byteOrderMark;
+	uint64_t identifierCount;
+	uint64_t namesSize;
+	uint64_t instructionCount;
+	uint64_t constantCount;
+	uint64_t operandCount;
+};
+
+enum class SnapshotIdentifierType : uint8_t
+{
+	UNDECLARED,
+	VARIABLE,
+	FUNCTION
+};
+
+struct SnapshotIdentifier
+{
+	uint64_t nameOffset;
+	uint32_t nameSize;
+	SnapshotIdentifierType type;
+	uint8_t reserved[3];
+	double value;
+	uint64_t codeOffset;
+	uint64_t constantOffset;
+	uint64_t operandOffset;
+	uint32_t codeSize;
+	uint32_t constantCount;
+	uint32_t operandCount;
+	uint32_t stackSize;
+};
+
+static_assert(sizeof(Instruction) == 8);
+static_assert(sizeof(SnapshotHeader) % 8 == 0 && sizeof(SnapshotIdentifier) % 8 == 0);
+
+#endif // CALCULATOR_SNAPSHOT_H
@@ -0,0 +1,84 @@
+#include "WorkerPool.h"
+#include <algorithm>
+
+using namespace std;
+
+CWorkerPool::CWorkerPool(size_t threadCount)
+{
+	size_t workerCount = max<size_t>(threadCount, 1) - 1;
+	m_workers.reserve(workerCount);
+	for (size_t i = 0; i < workerCount; ++i)
+	{
+		m_workers.emplace_back([this](stop_token stopToken) {
+			Work(stopToken);
+		});
+	}
+}
+
+CWorkerPool& CWorkerPool::GetInstance()
+{
+	static CWorkerPool pool(thread::hardware_concurrency());
+	return pool;
+}
+
+size_t CWorkerPool::GetThreadCount() const
+{
+	return m_workers.size() + 1;
+}
+
+void CWorkerPool::Run(size_t taskCount, const function<void(size_t)>& task)
+{
+	lock_guard runLock(m_runMutex);
+	{
+		lock_guard lock(m_mutex);
+		m_task = &task;
+		m_taskCount = taskCount;
+		m_nextTask.store(0, memory_order_relaxed);
+		++m_jobNumber;
+	}
+	m_jobStarted.notify_all();
+	RunTasks(task, taskCount);
+
+	// every task is taken, wait for the workers still running one
+	unique_lock lock(m_mutex);
+	m_jobFinished.wait(lock, [this] {
+		return m_busyWorkers == 0;
+	});
+	m_task = nullptr;
+}
+
+void CWorkerPool::Work(stop_token stopToken)
+{
+	uint64_t lastJobNumber = 0;
+	unique_lock lock(m_mutex);
+	while (m_jobStarted.wait(lock, stopToken, [this, &lastJobNumber] {
+		return m_jobNumber != lastJobNumber;
+	}))
+	{
+		lastJobNumber = m_jobNumber;
+		// a worker woken after its job finished has nothing to do
+		if (!m_task)
+		{
+			continue;
+		}
+		const function<void(size_t)>& task = *m_task;
+		size_t taskCount = m_taskCount;
+		++m_busyWorkers;
+		lock.unlock();
+		RunTasks(task, taskCount);
+		lock.lock();
+		if (--m_busyWorkers == 0)
+		{
+			m_jobFinished.notify_one();
+		}
+	}
+}
+
+void CWorkerPool::RunTasks(const function<void(size_t)>& task, size_t taskCount)
+{
+	for (size_t i = m_nextTask.fetch_add(1, memory_order_relaxed); i < taskCount;
+		 i = m_nextTask.fetch_add(1, memory_order_relaxed))
+	{
+		task(i);
+	}
+}
@@ -0,0 +1,49 @@
+#ifndef CALCULATOR_WORKERPOOL_H
+#define CALCULATOR_WORKERPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <stop_token>
+#include <thread>
+#include <vector>
+
+// Threads started once and reused by every job. A job is a number of tasks, the
+// workers and the calling thread take tasks until none is left. One job runs at a time.
+class CWorkerPool
+{
+public:
+	// threadCount includes the calling thread, so a pool of 1 runs every job on the caller
+	explicit CWorkerPool(size_t threadCount);
+
+	CWorkerPool(const CWorkerPool&) = delete;
+	CWorkerPool& operator=(const CWorkerPool&) = delete;
+
+	// one worker per hardware thread besides the caller, started on first use
+	static CWorkerPool& GetInstance();
+
+	[[nodiscard]] size_t GetThreadCount() const;
+	// task is called once for every index below taskCount, returns when all calls are done
+	void Run(size_t taskCount, const std::function<void(size_t)>& task);
+
+private:
+	void Work(std::stop_token stopToken);
+	void RunTasks(const std::function<void(size_t)>& task, size_t taskCount);
+
+	std::mutex m_runMutex;
+	std::mutex m_mutex;
+	std::condition_variable_any m_jobStarted;
+	std::condition_variable m_jobFinished;
+	// job being run, null between jobs; guarded by m_mutex
+	const std::function<void(size_t)>* m_task = nullptr;
+	size_t m_taskCount = 0;
+	uint64_t m_jobNumber = 0;
+	size_t m_busyWorkers = 0;
+	std::atomic<size_t> m_nextTask = 0;
+	// declared last so the workers are stopped before the state they use is destroyed
+	std::vector<std::jthread> m_workers;
+};
+
+#endif // CALCULATOR_WORKERPOOL_H
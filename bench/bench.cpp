@@ -0,0 +1,421 @@
+#include "catch2/catch_test_macros.hpp"
+#include <catch2/benchmark/catch_benchmark.hpp>
+
+#include "../Calculator.h"
+#include "../IOControl.h"
+#include "../SharedCalculator.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <malloc.h>
+
+using namespace std;
+
+// counts live heap bytes to report memory per identifier; aligned allocations are
+// counted too, the pool resource of the calculator makes those
+static atomic<size_t> allocatedBytes = 0;
+
+static void* CountAllocation(void* ptr)
+{
+	if (!ptr)
+	{
+		throw bad_alloc();
+	}
+	allocatedBytes += malloc_usable_size(ptr);
+	return ptr;
+}
+
+static void ReleaseAllocation(void* ptr) noexcept
+{
+	if (ptr)
+	{
+		allocatedBytes -= malloc_usable_size(ptr);
+		free(ptr);
+	}
+}
+
+void* operator new(size_t size)
+{
+	return CountAllocation(malloc(size));
+}
+
+void* operator new(size_t size, align_val_t alignment)
+{
+	auto alignmentSize = static_cast<size_t>(alignment);
+	return CountAllocation(aligned_alloc(alignmentSize, (max<size_t>(size, 1) + alignmentSize - 1) / alignmentSize * alignmentSize));
+}
+
+void operator delete(void* ptr) noexcept
+{
+	ReleaseAllocation(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept
+{
+	ReleaseAllocation(ptr);
+}
+
+void operator delete(void* ptr, align_val_t) noexcept
+{
+	ReleaseAllocation(ptr);
+}
+
+void operator delete(void* ptr, size_t, align_val_t) noexcept
+{
+	ReleaseAllocation(ptr);
+}
+
+namespace
+{
+constexpr int COMMAND_COUNT = 10000;
+constexpr int CHAIN_DEPTH = 1000;
+constexpr int GRAPH_WIDTH = 1000;
+constexpr int TABLE_SIZE = 100000;
+constexpr int READER_COUNT = 4;
+constexpr int READS_PER_READER = 100000;
+constexpr auto WRITE_INTERVAL = chrono::microseconds(200);
+
+string MakeVarScript()
+{
+	string script;
+	for (int i = 0; i < COMMAND_COUNT; ++i)
+	{
+		script += "var v" + to_string(i) + "\n";
+	}
+	return script;
+}
+
+string MakeLetScript()
+{
+	string script;
+	for (int i = 0; i < COMMAND_COUNT; ++i)
+	{
+		script += "let v" + to_string(i) + "=" + to_string(i) + ".5\n";
+	}
+	return script;
+}
+
+string MakeFnScript()
+{
+	string script = "let x=1\n";
+	for (int i = 0; i < COMMAND_COUNT; ++i)
+	{
+		script += "fn f" + to_string(i) + "=x*" + to_string(i) + "+x\n";
+	}
+	return script;
+}
+
+size_t RunCommands(const string& script)
+{
+	CCalculator calc;
+	istringstream input(script);
+	ostringstream output;
+	CControl ctrl(calc, input, output);
+	while (input)
+	{
+		ctrl.HandleCommand();
+	}
+	return calc.GetAllVariables().size();
+}
+
+// f0 = x + 1, fi = f(i-1) + x
+void FillDeepChain(CCalculator& calc)
+{
+	calc.AddVariableWithValue("x", 1.0);
+	calc.AddFunctionWithOperation("f0", "x+1");
+	for (int i = 1; i < CHAIN_DEPTH; ++i)
+	{
+		calc.AddFunctionWithOperation("f" + to_string(i), "f" + to_string(i - 1) + "+x");
+	}
+}
+
+// fi = x * i, top = f0 + f1 + ... + f(width - 1)
+void FillWideGraph(CCalculator& calc)
+{
+	calc.AddVariableWithValue("x", 1.0);
+	string top = "f0";
+	calc.AddFunctionWithOperation("f0", "x*0");
+	for (int i = 1; i < GRAPH_WIDTH; ++i)
+	{
+		calc.AddFunctionWithOperation("f" + to_string(i), "x*" + to_string(i));
+		top += "+f" + to_string(i);
+	}
+	calc.AddFunctionWithOperation("top", top);
+}
+
+void FillTable(CCalculator& calc)
+{
+	calc.AddVariableWithValue("x", 1.0);
+	for (int i = 0; i < TABLE_SIZE; ++i)
+	{
+		calc.AddVariableWithValue("v" + to_string(i), i * 0.5);
+		calc.AddFunctionWithOperation("f" + to_string(i), "v" + to_string(i) + "*x");
+	}
+}
+// readerCount readers call read concurrently while one writer keeps calling write
+template <typename Read, typename Write>
+double RunConcurrentReads(int readerCount, Read&& read, Write&& write)
+{
+	atomic<bool> done = false;
+	jthread writer([&] {
+		double x = 1;
+		while (!done)
+		{
+			write(++x);
+			this_thread::sleep_for(WRITE_INTERVAL);
+		}
+	});
+	vector<double> sums(readerCount, 0);
+	{
+		vector<jthread> readers;
+		for (int i = 0; i < readerCount; ++i)
+		{
+			readers.emplace_back([&, i] {
+				for (int j = 0; j < READS_PER_READER; ++j)
+				{
+					sums[i] += read();
+				}
+			});
+		}
+	}
+	done = true;
+	double sum = 0;
+	for (double value: sums)
+	{
+		sum += value;
+	}
+	return sum;
+}
+} // namespace
+
+TEST_CASE("HandleCommand throughput")
+{
+	const string varScript = MakeVarScript();
+	const string letScript = MakeLetScript();
+	const string fnScript = MakeFnScript();
+
+	BENCHMARK("var x10000")
+	{
+		return RunCommands(varScript);
+	};
+	BENCHMARK("let x10000")
+	{
+		return RunCommands(letScript);
+	};
+	BENCHMARK("fn x10000")
+	{
+		return RunCommands(fnScript);
+	};
+}
+
+TEST_CASE("Loading fn lines scales linearly")
+{
+	// each size is loaded once, equal cost per line means linear loading
+	for (int count: { 10000, 100000, 1000000 })
+	{
+		string script = "let x=1\n";
+		for (int i = 0; i < count; ++i)
+		{
+			script += "fn f" + to_string(i) + "=x*" + to_string(i) + "+x\n";
+		}
+		CCalculator calc;
+		istringstream input;
+		ostringstream output;
+		CControl ctrl(calc, input, output);
+		auto start = chrono::steady_clock::now();
+		ctrl.RunScript(script);
+		auto time = chrono::steady_clock::now() - start;
+		WARN("fn x" << count << ": " << chrono::duration_cast<chrono::nanoseconds>(time).count() / count << " ns per line");
+	}
+}
+
+TEST_CASE("GetFunctionValue latency")
+{
+	CCalculator deep;
+	FillDeepChain(deep);
+	CCalculator wide;
+	FillWideGraph(wide);
+	double x = 1;
+
+	BENCHMARK("deep chain of 1000, cached")
+	{
+		return deep.GetFunctionValue("f999");
+	};
+	BENCHMARK("deep chain of 1000, after let")
+	{
+		deep.AddVariableWithValue("x", ++x);
+		return deep.GetFunctionValue("f999");
+	};
+	BENCHMARK("deep chain of 1000, compiled, after let")
+	{
+		deep.AddVariableWithValue("x", ++x);
+		return deep.EvaluateCompiledFunction("f999");
+	};
+	BENCHMARK("wide graph of 1000, cached")
+	{
+		return wide.GetFunctionValue("top");
+	};
+	BENCHMARK("wide graph of 1000, after let")
+	{
+		wide.AddVariableWithValue("x", ++x);
+		return wide.GetFunctionValue("top");
+	};
+	BENCHMARK("wide graph of 1000, compiled, after let")
+	{
+		wide.AddVariableWithValue("x", ++x);
+		return wide.EvaluateCompiledFunction("top");
+	};
+}
+
+TEST_CASE("Sweep over a variable")
+{
+	CCalculator calc;
+	FillWideGraph(calc);
+	vector<double> values;
+	for (int i = 0; i < COMMAND_COUNT; ++i)
+	{
+		values.push_back(i * 0.25);
+	}
+
+	BENCHMARK("sweep wide graph of 1000 over 10000 values")
+	{
+		return calc.Sweep("top", "x", values);
+	};
+	BENCHMARK("let + GetFunctionValue over 10000 values")
+	{
+		double sum = 0;
+		for (double value: values)
+		{
+			calc.AddVariableWithValue("x", value);
+			sum += calc.GetFunctionValue("top");
+		}
+		return sum;
+	};
+}
+
+TEST_CASE("Bulk import")
+{
+	string letScript;
+	string csv;
+	for (int i = 0; i < TABLE_SIZE; ++i)
+	{
+		letScript += "let v" + to_string(i) + "=" + to_string(i) + ".5\n";
+		csv += "v" + to_string(i) + "," + to_string(i) + ".5\n";
+	}
+
+	BENCHMARK("let x100000")
+	{
+		CCalculator calc;
+		istringstream input;
+		ostringstream output;
+		CControl ctrl(calc, input, output);
+		ctrl.RunScript(letScript);
+		return calc.GetVariableValueByName("v1");
+	};
+	BENCHMARK("ImportVariables x100000")
+	{
+		CCalculator calc;
+		calc.ImportVariables(csv);
+		return calc.GetVariableValueByName("v1");
+	};
+}
+
+TEST_CASE("Listing large symbol tables")
+{
+	CCalculator calc;
+	FillTable(calc);
+	istringstream input;
+	ostringstream output;
+	CControl ctrl(calc, input, output);
+	double x = 1;
+
+	BENCHMARK("printvars over 100000 variables")
+	{
+		output.str(string());
+		ctrl.RunScript("printvars"sv);
+		return output.tellp();
+	};
+	BENCHMARK("printfns over 100000 functions, cached")
+	{
+		output.str(string());
+		ctrl.RunScript("printfns"sv);
+		return output.tellp();
+	};
+	BENCHMARK("printfns over 100000 functions, after let")
+	{
+		calc.AddVariableWithValue("x", ++x);
+		output.str(string());
+		ctrl.RunScript("printfns"sv);
+		return output.tellp();
+	};
+}
+
+TEST_CASE("Memory per identifier")
+{
+	size_t before = allocatedBytes;
+	{
+		CCalculator calc;
+		FillTable(calc);
+		size_t perIdentifier = (allocatedBytes - before) / (2 * TABLE_SIZE + 1);
+		WARN("live heap bytes per identifier (variable + function table): " << perIdentifier);
+	}
+}
+
+TEST_CASE("Concurrent reads")
+{
+	CSharedCalculator shared;
+	shared.Update([](CCalculator& calc) {
+		FillWideGraph(calc);
+		return true;
+	});
+	CCalculator locked;
+	FillWideGraph(locked);
+	mutex lockedMutex;
+
+	BENCHMARK("4 readers x 100000 GetFunctionValue, shared calculator")
+	{
+		return RunConcurrentReads(READER_COUNT,
+			[&] { return shared.GetFunctionValue("top"); },
+			[&](double x) { shared.AddVariableWithValue("x", to_string(x)); });
+	};
+	BENCHMARK("4 readers x 100000 GetFunctionValue, calculator behind a mutex")
+	{
+		return RunConcurrentReads(READER_COUNT,
+			[&] {
+				lock_guard lock(lockedMutex);
+				return locked.GetFunctionValue("top");
+			},
+			[&](double x) {
+				lock_guard lock(lockedMutex);
+				locked.AddVariableWithValue("x", x);
+			});
+	};
+}
+
+// on a multi-core machine total time stays flat while readers share no written cache line
+TEST_CASE("Reader scaling")
+{
+	CSharedCalculator shared;
+	shared.Update([](CCalculator& calc) {
+		FillWideGraph(calc);
+		return true;
+	});
+
+	for (int readerCount: { 1, 2, 4, 8 })
+	{
+		BENCHMARK(to_string(readerCount) + " readers x 100000 GetFunctionValue, shared calculator")
+		{
+			return RunConcurrentReads(readerCount,
+				[&] { return shared.GetFunctionValue("top"); },
+				[&](double x) { shared.AddVariableWithValue("x", to_string(x)); });
+		};
+	}
+}
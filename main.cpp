@@ -1,9 +1,45 @@
+#include "Calculator.h"
+#include "IOControl.h"
+#include "MappedFile.h"
+#include "Server.h"
 #include <iostream>
-#include <cmath>
+#include <string>
 
-int main()
+int main(int argc, char* argv[])
 {
-    double d = 2e1;
-    std::cout << d << std::endl;
-    return 0;
+	std::ios::sync_with_stdio(false);
+	CCalculator calc;
+	CControl control(calc, std::cin, std::cout);
+
+	if (argc > 2 && std::string(argv[1]) == "--socket")
+	{
+		CServer server(calc);
+		if (!server.Listen(argv[2]))
+		{
+			std::cerr << "Cannot listen on " << argv[2] << std::endl;
+			return 1;
+		}
+		return server.Run() ? 0 : 1;
+	}
+	if (argc > 1 && std::string(argv[1]) == "--batch")
+	{
+		control.RunScript();
+		return 0;
+	}
+	if (argc > 1)
+	{
+		CMappedFile script;
+		if (!script.Open(argv[1]))
+		{
+			std::cerr << "Cannot open script " << argv[1] << std::endl;
+			return 1;
+		}
+		control.RunScript(script.GetData());
+		return 0;
+	}
+	while (std::cin)
+	{
+		control.HandleCommand();
+	}
+	return 0;
 }
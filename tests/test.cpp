@@ -3,9 +3,22 @@
 
 #include "../Calculator.h"
 #include "../IOControl.h"
+#include "../Server.h"
+#include "../SharedCalculator.h"
+#include "../WorkerPool.h"
 
 #include <sstream>
+#include <algorithm>
+#include <atomic>
 #include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
 
 using namespace std;
 
@@ -352,6 +365,32 @@ TEST_CASE("Declare function")
 	}
 }
 
+TEST_CASE("Function declared with a variable follows it")
+{
+	CCalculator calc;
+	stringstream inpStr;
+	stringstream outStr;
+	CControl ctrl(calc, inpStr, outStr);
+
+	inpStr << "let a=1\nfn f=a\nfn g=f*2\nlet a=5\nprint f\nprint g\n"s;
+	for (int i = 0; i < 6; ++i)
+	{
+		REQUIRE(ctrl.HandleCommand());
+	}
+	REQUIRE(outStr.str() == "5.00\n10.00\n"s);
+	REQUIRE(calc.GetVariableValueByName("f") == Catch::Approx(5));
+	REQUIRE(calc.CompileFunction("g"));
+	calc.AddVariableWithValue("a", "-3");
+	REQUIRE(calc.EvaluateCompiledFunction("g") == Catch::Approx(-6));
+	auto results = calc.Sweep("g", "a", { 1, 2 });
+	REQUIRE(results.size() == 2);
+	REQUIRE(results[0] == Catch::Approx(2));
+	REQUIRE(results[1] == Catch::Approx(4));
+	calc.SetReactive(true);
+	calc.AddVariableWithValue("a", "7");
+	REQUIRE(calc.TakeChanges().size() == 2);
+}
+
 SCENARIO("Print all functions")
 {
 	GIVEN("Calc without functions")
@@ -419,3 +458,1381 @@ SCENARIO("Zero division")
 	}
 }
 
+
+SCENARIO("Function values are cached and invalidated on variable change")
+{
+	GIVEN("Calc with Fibonacci-style chain of 50 functions")
+	{
+		CCalculator calc;
+		calc.AddVariableWithValue("fib0", "0");
+		calc.AddVariableWithValue("fib1", "1");
+		for (int i = 2; i <= 50; ++i)
+		{
+			calc.AddFunctionWithOperation("fib" + to_string(i),
+				"fib" + to_string(i - 1) + "+fib" + to_string(i - 2));
+		}
+
+		THEN("Chain is evaluated without exponential recursion")
+		{
+			REQUIRE(calc.GetFunctionValue("fib50") == Catch::Approx(12586269025.0));
+		}
+
+		WHEN("Variable at the bottom of the chain changes")
+		{
+			REQUIRE(calc.GetFunctionValue("fib50") == Catch::Approx(12586269025.0));
+			calc.AddVariableWithValue("fib0", "1");
+
+			THEN("Dependent functions are recalculated")
+			{
+				REQUIRE(calc.GetFunctionValue("fib2") == Catch::Approx(2));
+				REQUIRE(calc.GetFunctionValue("fib50") == Catch::Approx(20365011074.0));
+			}
+		}
+
+		WHEN("Variable is reassigned with other variable value")
+		{
+			REQUIRE(calc.GetFunctionValue("fib3") == Catch::Approx(2));
+			calc.AddVariableWithValue("x", "5");
+			calc.AddVariableWithOtherVariableValue("fib1", "x");
+
+			THEN("Dependent functions see the new value")
+			{
+				REQUIRE(calc.GetVariableValueByName("fib1") == Catch::Approx(5));
+				REQUIRE(calc.GetFunctionValue("fib3") == Catch::Approx(10));
+			}
+		}
+	}
+}
+
+TEST_CASE("Function body is parsed at declaration")
+{
+	CCalculator calc;
+	calc.AddVariableWithValue("a", "6");
+	calc.AddVariableWithValue("b", "3");
+
+	calc.AddFunctionWithOperation("add", "a+b");
+	calc.AddFunctionWithOperation("sub", "a-b");
+	calc.AddFunctionWithOperation("mul", "a*b");
+	calc.AddFunctionWithOperation("div", "a/b");
+	calc.AddFunctionWithOperation("same", "add");
+	calc.AddFunctionWithOperation("bad", "a.b");
+
+	REQUIRE(calc.GetFunctionValue("add") == Catch::Approx(9));
+	REQUIRE(calc.GetFunctionValue("sub") == Catch::Approx(3));
+	REQUIRE(calc.GetFunctionValue("mul") == Catch::Approx(18));
+	REQUIRE(calc.GetFunctionValue("div") == Catch::Approx(2));
+	REQUIRE(calc.GetFunctionValue("same") == Catch::Approx(9));
+	REQUIRE(std::isnan(calc.GetFunctionValue("bad")));
+
+	calc.AddFunctionWithOperation("add", "a*a");
+	REQUIRE(calc.GetFunctionValue("same") == Catch::Approx(36));
+}
+
+TEST_CASE("Rejected function declares none of its names")
+{
+	CCalculator calc;
+	calc.AddVariableWithValue("a", "1");
+	string path = (filesystem::temp_directory_path() / "calculator_rejected_test.bin").string();
+	REQUIRE(calc.SaveSnapshot(path));
+	auto size = filesystem::file_size(path);
+
+	for (int i = 0; i < 1000; ++i)
+	{
+		string index = to_string(i);
+		REQUIRE_FALSE(calc.AddFunctionWithOperation("f" + index, "a+unknown" + index + ")"));
+	}
+	REQUIRE(calc.SaveSnapshot(path));
+	REQUIRE(filesystem::file_size(path) == size);
+	REQUIRE_FALSE(calc.Find("unknown0").has_value());
+	filesystem::remove(path);
+
+	REQUIRE(calc.AddFunctionWithOperation("g", "a+later+a"));
+	calc.AddVariableWithValue("later", "2");
+	REQUIRE(calc.GetFunctionValue("g") == Catch::Approx(4));
+}
+
+TEST_CASE("Variable values are parsed once at assignment")
+{
+	CCalculator calc;
+	stringstream inpStr;
+	stringstream outStr;
+	CControl ctrl(calc, inpStr, outStr);
+
+	inpStr << "let a=+2.5e1\n"s;
+	REQUIRE(ctrl.HandleCommand());
+	REQUIRE(calc.GetVariableValueByName("a") == Catch::Approx(25));
+
+	calc.AddVariableWithValue("b", -0.5);
+	REQUIRE(calc.GetVariableValueByName("b") == Catch::Approx(-0.5));
+
+	calc.AddVariable("c");
+	REQUIRE(std::isnan(calc.GetVariableValueByName("c")));
+
+	inpStr << "let d=1.5.3\n"s;
+	REQUIRE(ctrl.HandleCommand());
+	REQUIRE(calc.GetVariableValueByName("d") == Catch::Approx(1.5));
+	REQUIRE(ParseNumber("1.5.3", NumberExtent::PREFIX) == 1.5);
+	REQUIRE_FALSE(ParseNumber("1.5.3").has_value());
+	REQUIRE_FALSE(ParseNumber("+-1", NumberExtent::PREFIX).has_value());
+}
+
+SCENARIO("Function refers to identifiers declared later")
+{
+	GIVEN("Calc with function over not yet declared variables")
+	{
+		CCalculator calc;
+		calc.AddFunctionWithOperation("sum", "x+y");
+
+		THEN("Only declared identifiers are listed and function is nan")
+		{
+			REQUIRE(calc.GetAllVariables().size() == 1);
+			REQUIRE_FALSE(calc.GetIdentifierType("x").has_value());
+			REQUIRE(std::isnan(calc.GetFunctionValue("sum")));
+		}
+
+		WHEN("Operands are declared")
+		{
+			REQUIRE(calc.AddVariable("x"));
+			calc.AddVariableWithValue("x", "1");
+			calc.AddVariableWithValue("y", "2");
+
+			THEN("Function uses their values")
+			{
+				REQUIRE(calc.GetAllVariables().size() == 3);
+				REQUIRE(calc.GetFunctionValue("sum") == Catch::Approx(3));
+			}
+		}
+	}
+}
+
+TEST_CASE("Run script executes all commands")
+{
+	CCalculator calc;
+	stringstream inpStr;
+	stringstream outStr;
+	CControl ctrl(calc, inpStr, outStr);
+
+	inpStr << "let a=2\nlet b=3\nfn Sum=a+b\nprint Sum\nvar a\nlet c=a\nprintvars\nprint Sum"s;
+	ctrl.RunScript();
+	REQUIRE(outStr.str() == "5.00\nVariable already exist\na:2.00\nb:3.00\nc:2.00\n5.00\n"s);
+	REQUIRE(calc.GetAllVariables().size() == 4);
+}
+
+TEST_CASE("Command tokenizer keeps validation rules")
+{
+	CCalculator calc;
+	stringstream inpStr;
+	stringstream outStr;
+	CControl ctrl(calc, inpStr, outStr);
+
+	inpStr << "let a=1e-5\n"s;
+	REQUIRE_FALSE(ctrl.HandleCommand());
+	inpStr << "let a=-b\n"s;
+	REQUIRE_FALSE(ctrl.HandleCommand());
+	inpStr << "fn f=a.b\n"s;
+	REQUIRE_FALSE(ctrl.HandleCommand());
+	inpStr << "fn f=a+\n"s;
+	REQUIRE_FALSE(ctrl.HandleCommand());
+	REQUIRE(outStr.str() == "Not valid expression\nNot valid expression\nNot valid expression\nNot valid expression\n"s);
+	REQUIRE(calc.GetAllVariables().empty());
+
+	outStr.str(string());
+	inpStr << "  let\ta=-1.5e2  \n"s;
+	REQUIRE(ctrl.HandleCommand());
+	REQUIRE(calc.GetVariableValueByName("a") == Catch::Approx(-150));
+	inpStr << "fn f=a*a\n"s;
+	REQUIRE(ctrl.HandleCommand());
+	inpStr << "unknown a\n"s;
+	REQUIRE_FALSE(ctrl.HandleCommand());
+	REQUIRE(outStr.str().empty());
+}
+
+TEST_CASE("Run script from memory")
+{
+	CCalculator calc;
+	stringstream inpStr;
+	stringstream outStr;
+	CControl ctrl(calc, inpStr, outStr);
+
+	ctrl.RunScript("let a=2\nlet b=3\nfn Mult=a*b\n\nprintfns\nprint b"sv);
+	REQUIRE(outStr.str() == "Mult:6.00\n3.00\n"s);
+}
+
+TEST_CASE("Printing functions evaluated level by level matches serial evaluation")
+{
+	CCalculator calc;
+	CCalculator serialCalc;
+	stringstream inpStr;
+	stringstream outStr;
+	CControl ctrl(calc, inpStr, outStr);
+
+	for (CCalculator* c: { &calc, &serialCalc })
+	{
+		c->AddVariableWithValue("a", "1.5");
+		for (int i = 0; i < 10000; ++i)
+		{
+			c->AddVariableWithValue("x" + to_string(i), to_string(i));
+			c->AddFunctionWithOperation("f" + to_string(i), "a*x" + to_string(i));
+			c->AddFunctionWithOperation("g" + to_string(i), "f" + to_string(i) + "-a");
+		}
+		c->AddFunctionWithOperation("cycle1", "cycle2+a");
+		c->AddFunctionWithOperation("cycle2", "cycle1+a");
+	}
+
+	inpStr << "printfns\n"s;
+	REQUIRE(ctrl.HandleCommand());
+
+	string expected;
+	for (const auto& item: serialCalc.GetAllVariables())
+	{
+		if (item.identifierType == IdentifierType::FUNCTION)
+		{
+			stringstream line;
+			line << item.identifierName << ":" << fixed << setprecision(2)
+				 << serialCalc.GetFunctionValue(item.identifierName) << '\n';
+			expected += line.str();
+		}
+	}
+	REQUIRE(outStr.str() == expected);
+	REQUIRE(calc.GetFunctionValue("g10") == Catch::Approx(13.5));
+}
+
+TEST_CASE("Worker pool runs every task of every job")
+{
+	CWorkerPool pool(4);
+	REQUIRE(pool.GetThreadCount() == 4);
+	for (size_t taskCount: { 0, 1, 3, 100, 10000, 7 })
+	{
+		vector<atomic<int>> calls(taskCount);
+		pool.Run(taskCount, [&](size_t i) {
+			++calls[i];
+		});
+		REQUIRE(all_of(calls.begin(), calls.end(), [](const atomic<int>& count) {
+			return count == 1;
+		}));
+	}
+
+	CWorkerPool single(1);
+	vector<thread::id> callers;
+	single.Run(3, [&](size_t) {
+		callers.push_back(this_thread::get_id());
+	});
+	REQUIRE(callers == vector<thread::id>(3, this_thread::get_id()));
+}
+
+SCENARIO("Function declared with an arbitrary expression")
+{
+	GIVEN("Calc with variables a=2, b=3, c=4")
+	{
+		CCalculator calc;
+		stringstream inpStr;
+		stringstream outStr;
+		CControl ctrl(calc, inpStr, outStr);
+
+		calc.AddVariableWithValue("a", "2");
+		calc.AddVariableWithValue("b", "3");
+		calc.AddVariableWithValue("c", "4");
+
+		WHEN("Expression uses precedence, parentheses, literals and unary minus")
+		{
+			inpStr << "fn f = a + b * c - (a - b) / 2 + -c * 0.5e1\n"s;
+			REQUIRE(ctrl.HandleCommand());
+			inpStr << "fn g=(f+1)*(f-1)\n"s;
+			REQUIRE(ctrl.HandleCommand());
+			inpStr << "print g\n"s;
+			REQUIRE(ctrl.HandleCommand());
+
+			THEN("It is evaluated as one formula")
+			{
+				REQUIRE(calc.GetFunctionValue("f") == Catch::Approx(-5.5));
+				REQUIRE(outStr.str() == "29.25\n"s);
+			}
+		}
+
+		WHEN("Expression is malformed")
+		{
+			for (const auto& command: { "fn f=(a+b\n"s, "fn f=a+*b\n"s, "fn f=a b\n"s, "fn f=1.2.3\n"s, "fn f=\n"s })
+			{
+				inpStr << command;
+				REQUIRE_FALSE(ctrl.HandleCommand());
+			}
+
+			THEN("Function is not declared")
+			{
+				REQUIRE_FALSE(calc.GetIdentifierType("f").has_value());
+				REQUIRE(outStr.str() == "Not valid expression\nNot valid expression\nNot valid expression\nNot valid expression\nNot valid expression\n"s);
+			}
+		}
+
+		WHEN("Expression is nested deeper than the compiler allows")
+		{
+			inpStr << "fn f=" << string(200000, '(') << "a" << string(200000, ')') << '\n'
+				   << "fn f=" << string(300000, '-') << "a\n"
+				   << "fn f=" << string(500, '(') << "-a" << string(500, ')') << '\n';
+			REQUIRE_FALSE(ctrl.HandleCommand());
+			REQUIRE_FALSE(ctrl.HandleCommand());
+			REQUIRE(ctrl.HandleCommand());
+
+			THEN("It is rejected without exhausting the stack")
+			{
+				REQUIRE(outStr.str() == "Not valid expression\nNot valid expression\n"s);
+				REQUIRE(calc.GetFunctionValue("f") == Catch::Approx(-2));
+			}
+		}
+	}
+}
+
+SCENARIO("Sweep function over variable values")
+{
+	GIVEN("Calc with f=x*x+k, g=f/2 and h=k*3")
+	{
+		CCalculator calc;
+		stringstream inpStr;
+		stringstream outStr;
+		CControl ctrl(calc, inpStr, outStr);
+
+		calc.AddVariableWithValue("x", "1");
+		calc.AddVariableWithValue("k", "10");
+		calc.AddFunctionWithOperation("f", "x*x+k");
+		calc.AddFunctionWithOperation("g", "-f/2");
+		calc.AddFunctionWithOperation("h", "k*3");
+
+		WHEN("Sweeping a long column of values")
+		{
+			vector<double> values;
+			for (int i = 0; i < 3000; ++i)
+			{
+				values.push_back(i * 0.5);
+			}
+			auto results = calc.Sweep("g", "x", values);
+
+			THEN("Each result equals the scalar evaluation and x keeps its value")
+			{
+				REQUIRE(results.size() == values.size());
+				for (size_t i = 0; i < values.size(); i += 97)
+				{
+					REQUIRE(results[i] == Catch::Approx(-(values[i] * values[i] + 10) / 2));
+				}
+				REQUIRE(calc.GetVariableValueByName("x") == Catch::Approx(1));
+				REQUIRE(calc.GetFunctionValue("g") == Catch::Approx(-5.5));
+			}
+		}
+
+		WHEN("Function does not depend on the variable")
+		{
+			auto results = calc.Sweep("h", "x", { 1, 2 });
+
+			THEN("Its current value is repeated")
+			{
+				REQUIRE(results == vector<double>{ 30, 30 });
+			}
+		}
+
+		WHEN("Sweep command is used")
+		{
+			inpStr << "sweep f x 0 1 0.5\n"s;
+			REQUIRE(ctrl.HandleCommand());
+			inpStr << "sweep f y 0 1 0.5\n"s;
+			REQUIRE_FALSE(ctrl.HandleCommand());
+			inpStr << "sweep f x 0 1 0\n"s;
+			REQUIRE_FALSE(ctrl.HandleCommand());
+			inpStr << "sweep f x 0 1e13 1\nsweep f x 0 1e300 1e-300\nsweep f x 0 inf 1\nsweep f x 5 1 1\n"s;
+			for (int i = 0; i < 4; ++i)
+			{
+				REQUIRE_FALSE(ctrl.HandleCommand());
+			}
+
+			THEN("Results are printed one per line")
+			{
+				REQUIRE(outStr.str() == "10.00\n10.25\n11.00\nIdentifier not exist\nNot valid expression\nNot valid expression\n"
+					"Not valid expression\nNot valid expression\nNot valid expression\n"s);
+			}
+		}
+	}
+}
+
+SCENARIO("Reset drops all identifiers")
+{
+	GIVEN("Calc with variables and functions")
+	{
+		CCalculator calc;
+		for (int i = 0; i < 1000; ++i)
+		{
+			calc.AddVariableWithValue("long_variable_name_" + to_string(i), i);
+			calc.AddFunctionWithOperation("long_function_name_" + to_string(i), "long_variable_name_" + to_string(i) + "*2+1");
+		}
+		REQUIRE(calc.GetFunctionValue("long_function_name_10") == Catch::Approx(21));
+
+		WHEN("Calculator is reset")
+		{
+			calc.Reset();
+
+			THEN("It is empty and can be filled again")
+			{
+				REQUIRE(calc.GetAllVariables().empty());
+				REQUIRE_FALSE(calc.GetIdentifierType("long_variable_name_10").has_value());
+				REQUIRE(std::isnan(calc.GetFunctionValue("long_function_name_10")));
+
+				calc.AddVariableWithValue("long_variable_name_10", "5");
+				calc.AddFunctionWithOperation("f", "long_variable_name_10+1");
+				REQUIRE(calc.GetAllVariables().size() == 2);
+				REQUIRE(calc.GetFunctionValue("f") == Catch::Approx(6));
+			}
+		}
+	}
+}
+
+SCENARIO("Snapshot round trip")
+{
+	GIVEN("Calc with variables, functions and a forward reference")
+	{
+		CCalculator calc;
+		calc.AddVariableWithValue("x", "2.5");
+		calc.AddVariable("y");
+		calc.AddVariableWithValue("z", "-4");
+		calc.AddFunctionWithOperation("f", "x*2+z");
+		calc.AddFunctionWithOperation("g", "-(f-x)/3");
+		calc.AddFunctionWithOperation("h", "later+1");
+		calc.AddFunctionWithVariable("ref", "x");
+		string path = (filesystem::temp_directory_path() / "calculator_snapshot_test.bin").string();
+
+		WHEN("It is saved and loaded into another calculator")
+		{
+			REQUIRE(calc.SaveSnapshot(path));
+			CCalculator loaded;
+			loaded.AddVariableWithValue("stale", "1");
+			REQUIRE(loaded.LoadSnapshot(path));
+
+			THEN("Identifiers and function values are the same")
+			{
+				auto expected = calc.GetAllVariables();
+				auto actual = loaded.GetAllVariables();
+				REQUIRE(actual.size() == expected.size());
+				for (auto itExpected = expected.begin(), itActual = actual.begin(); itExpected != expected.end(); ++itExpected, ++itActual)
+				{
+					REQUIRE(itActual->identifierName == itExpected->identifierName);
+					REQUIRE(itActual->identifierType == itExpected->identifierType);
+					REQUIRE((itActual->identifierValue == itExpected->identifierValue
+						|| (std::isnan(itActual->identifierValue) && std::isnan(itExpected->identifierValue))));
+				}
+				REQUIRE(loaded.GetFunctionValue("f") == Catch::Approx(1));
+				REQUIRE(loaded.GetFunctionValue("g") == Catch::Approx(0.5));
+				REQUIRE(loaded.GetFunctionValue("ref") == Catch::Approx(2.5));
+				REQUIRE(std::isnan(loaded.GetFunctionValue("h")));
+				REQUIRE_FALSE(loaded.GetIdentifierType("stale").has_value());
+			}
+
+			THEN("Loaded functions still react to changes")
+			{
+				loaded.AddVariableWithValue("x", "3");
+				loaded.AddVariableWithValue("later", "1");
+				REQUIRE(loaded.GetFunctionValue("f") == Catch::Approx(2));
+				REQUIRE(loaded.GetFunctionValue("h") == Catch::Approx(2));
+				REQUIRE(loaded.GetFunctionValue("ref") == Catch::Approx(3));
+			}
+		}
+
+		WHEN("The file is damaged")
+		{
+			REQUIRE(calc.SaveSnapshot(path));
+			string contents;
+			{
+				ifstream input(path, ios::binary);
+				contents.assign(istreambuf_iterator<char>(input), {});
+			}
+			CCalculator loaded;
+			loaded.AddVariableWithValue("stale", "1");
+
+			THEN("Truncated file is rejected")
+			{
+				ofstream(path, ios::binary | ios::trunc).write(contents.data(), static_cast<streamsize>(contents.size() / 2));
+				REQUIRE_FALSE(loaded.LoadSnapshot(path));
+				REQUIRE(loaded.GetAllVariables().empty());
+			}
+
+			THEN("Unknown version is rejected")
+			{
+				contents[8] = 99;
+				ofstream(path, ios::binary | ios::trunc).write(contents.data(), static_cast<streamsize>(contents.size()));
+				REQUIRE_FALSE(loaded.LoadSnapshot(path));
+				REQUIRE(loaded.GetAllVariables().empty());
+			}
+
+			THEN("Version 1 file is still loaded")
+			{
+				contents[8] = 1;
+				ofstream(path, ios::binary | ios::trunc).write(contents.data(), static_cast<streamsize>(contents.size()));
+				REQUIRE(loaded.LoadSnapshot(path));
+				REQUIRE(loaded.GetFunctionValue("ref") == Catch::Approx(2.5));
+			}
+
+			THEN("Missing file is rejected and the state is kept")
+			{
+				filesystem::remove(path);
+				REQUIRE_FALSE(loaded.LoadSnapshot(path));
+				REQUIRE(loaded.GetVariableValueByName("stale") == Catch::Approx(1));
+			}
+		}
+
+		WHEN("The same state is saved twice")
+		{
+			REQUIRE(calc.SaveSnapshot(path));
+			string first;
+			{
+				ifstream input(path, ios::binary);
+				first.assign(istreambuf_iterator<char>(input), {});
+			}
+			auto copy = calc.Clone();
+			REQUIRE(copy->SaveSnapshot(path));
+			string second;
+			{
+				ifstream input(path, ios::binary);
+				second.assign(istreambuf_iterator<char>(input), {});
+			}
+
+			THEN("The files are identical")
+			{
+				REQUIRE(first == second);
+			}
+		}
+		filesystem::remove(path);
+	}
+}
+
+TEST_CASE("Shared calculator snapshot outlives newer versions")
+{
+	CSharedCalculator shared;
+	REQUIRE(shared.AddVariableWithValue("x", "1"));
+	REQUIRE(shared.AddFunctionWithOperation("f", "x*2"));
+	{
+		auto snapshot = shared.GetSnapshot();
+		for (int i = 2; i <= 100; ++i)
+		{
+			REQUIRE(shared.AddVariableWithValue("x", to_string(i)));
+		}
+		REQUIRE(snapshot->GetFunctionValue("f") == Catch::Approx(2));
+		auto latest = shared.GetSnapshot();
+		REQUIRE((*latest).GetFunctionValue("f") == Catch::Approx(200));
+	}
+	REQUIRE(shared.AddVariableWithValue("x", "0"));
+	REQUIRE(shared.GetFunctionValue("f") == Catch::Approx(0));
+}
+
+SCENARIO("Shared calculator under concurrent readers and writers")
+{
+	GIVEN("Shared calc where f and g depend on x")
+	{
+		CSharedCalculator shared;
+		REQUIRE(shared.Update([](CCalculator& calc) {
+			return calc.AddVariableWithValue("x", "0") && calc.AddFunctionWithOperation("f", "x*2+1")
+				&& calc.AddFunctionWithOperation("g", "f-x");
+		}));
+		REQUIRE_FALSE(shared.AddFunctionWithOperation("f", "x+"));
+		REQUIRE(shared.GetFunctionValue("f") == Catch::Approx(1));
+
+		WHEN("Readers run while writers change x and redefine g")
+		{
+			constexpr int READER_COUNT = 4;
+			constexpr int WRITE_COUNT = 2000;
+			atomic<int> inconsistentReads = 0;
+			atomic<int> readsGoingBack = 0;
+			atomic<bool> done = false;
+			{
+				vector<jthread> readers;
+				for (int i = 0; i < READER_COUNT; ++i)
+				{
+					readers.emplace_back([&] {
+						double lastX = 0;
+						while (!done)
+						{
+							auto snapshot = shared.GetSnapshot();
+							double x = snapshot->GetVariableValueByName("x");
+							double f = snapshot->GetFunctionValue("f");
+							double g = snapshot->GetFunctionValue("g");
+							if (f != x * 2 + 1 || (g != f - x && g != f + x)
+								|| snapshot->GetSortedIds(IdentifierType::FUNCTION).size() != 2)
+							{
+								++inconsistentReads;
+							}
+							if (x < lastX)
+							{
+								++readsGoingBack;
+							}
+							lastX = x;
+						}
+					});
+				}
+				jthread redefiner([&] {
+					for (int i = 0; i < WRITE_COUNT; ++i)
+					{
+						shared.AddFunctionWithOperation("g", i % 2 == 0 ? "f+x" : "f-x");
+					}
+				});
+				for (int i = 1; i <= WRITE_COUNT; ++i)
+				{
+					shared.AddVariableWithValue("x", to_string(i));
+				}
+				redefiner.join();
+				done = true;
+			}
+
+			THEN("Every snapshot is consistent and versions only move forward")
+			{
+				REQUIRE(inconsistentReads == 0);
+				REQUIRE(readsGoingBack == 0);
+				REQUIRE(shared.GetVariableValueByName("x") == Catch::Approx(WRITE_COUNT));
+				REQUIRE(shared.GetFunctionValue("f") == Catch::Approx(WRITE_COUNT * 2 + 1));
+			}
+		}
+	}
+}
+
+SCENARIO("Reactive mode recomputes dependents on change")
+{
+	GIVEN("Reactive calc with a diamond of functions over x and a function over y")
+	{
+		CCalculator calc;
+		stringstream inpStr;
+		stringstream outStr;
+		CControl ctrl(calc, inpStr, outStr);
+		calc.AddVariableWithValue("x", "1");
+		calc.AddVariableWithValue("y", "10");
+		calc.AddFunctionWithOperation("a", "x+1");
+		calc.AddFunctionWithOperation("b", "x*2");
+		calc.AddFunctionWithOperation("top", "a+b");
+		calc.AddFunctionWithOperation("other", "y+1");
+		inpStr << "reactive on\n"s;
+		REQUIRE(ctrl.HandleCommand());
+		REQUIRE(calc.IsReactive());
+
+		WHEN("x changes")
+		{
+			calc.AddVariableWithValue("x", "2");
+
+			THEN("Only functions over x changed, dependencies first")
+			{
+				auto changes = calc.TakeChanges();
+				REQUIRE(changes.size() == 3);
+				REQUIRE(changes.back().functionName == "top");
+				REQUIRE(changes.back().oldValue == Catch::Approx(4));
+				REQUIRE(changes.back().newValue == Catch::Approx(7));
+				REQUIRE(calc.TakeChanges().empty());
+			}
+		}
+
+		WHEN("x changes many times before anyone takes the changes")
+		{
+			for (int x = 2; x <= 1000; ++x)
+			{
+				calc.AddVariableWithValue("x", x);
+			}
+			calc.AddVariableWithValue("y", "11");
+			calc.AddVariableWithValue("y", "10");
+
+			THEN("Each function keeps one entry from its first to its last value")
+			{
+				auto changes = calc.TakeChanges();
+				REQUIRE(changes.size() == 3);
+				REQUIRE(changes[0].functionName == "a");
+				REQUIRE(changes[0].oldValue == Catch::Approx(2));
+				REQUIRE(changes[0].newValue == Catch::Approx(1001));
+				REQUIRE(changes.back().functionName == "top");
+				REQUIRE(changes.back().oldValue == Catch::Approx(4));
+				REQUIRE(changes.back().newValue == Catch::Approx(3001));
+				calc.AddVariableWithValue("x", "1");
+				REQUIRE(calc.TakeChanges().size() == 3);
+			}
+		}
+
+		WHEN("A change does not alter a value")
+		{
+			calc.AddFunctionWithOperation("b", "x*0+2");
+
+			THEN("It is not reported")
+			{
+				REQUIRE(calc.TakeChanges().empty());
+				REQUIRE(calc.GetFunctionValue("top") == Catch::Approx(4));
+			}
+		}
+
+		WHEN("Changes are printed")
+		{
+			inpStr << "let y=20\n"s;
+			REQUIRE(ctrl.HandleCommand());
+			inpStr << "changes\n"s;
+			REQUIRE(ctrl.HandleCommand());
+			inpStr << "reactive maybe\n"s;
+			REQUIRE_FALSE(ctrl.HandleCommand());
+
+			THEN("Delta list is printed")
+			{
+				REQUIRE(outStr.str() == "other changed from 11.00 to 21.00\nNot valid expression\n"s);
+			}
+		}
+
+		WHEN("Functions form a cycle")
+		{
+			calc.AddFunctionWithOperation("c1", "c2+x");
+			calc.AddFunctionWithOperation("c2", "c1+x");
+			calc.AddVariableWithValue("x", "5");
+
+			THEN("Values of the rest stay correct")
+			{
+				REQUIRE(std::isnan(calc.GetFunctionValue("c1")));
+				REQUIRE(calc.GetFunctionValue("top") == Catch::Approx(16));
+			}
+		}
+	}
+}
+
+SCENARIO("Evaluation does not depend on call stack depth")
+{
+	GIVEN("Chain of 100000 functions over x")
+	{
+		constexpr int DEPTH = 100000;
+		CCalculator calc;
+		calc.AddVariableWithValue("x", "1");
+		calc.AddFunctionWithOperation("f0", "x+1");
+		for (int i = 1; i < DEPTH; ++i)
+		{
+			calc.AddFunctionWithOperation("f" + to_string(i), "f" + to_string(i - 1) + "+1");
+		}
+
+		WHEN("The last function is read")
+		{
+			THEN("Whole chain is evaluated")
+			{
+				REQUIRE(calc.GetFunctionValue("f99999") == Catch::Approx(DEPTH + 1));
+				calc.AddVariableWithValue("x", "2");
+				REQUIRE(calc.GetFunctionValue("f99999") == Catch::Approx(DEPTH + 2));
+			}
+		}
+
+		WHEN("The chain is closed into a ring")
+		{
+			calc.AddFunctionWithOperation("f0", "f99999+x");
+
+			THEN("Every function of the ring is NAN")
+			{
+				REQUIRE(std::isnan(calc.GetFunctionValue("f50000")));
+				REQUIRE(std::isnan(calc.GetFunctionValue("f0")));
+			}
+		}
+	}
+
+	GIVEN("Redefinition that creates a cycle")
+	{
+		CCalculator calc;
+		stringstream inpStr;
+		stringstream outStr;
+		CControl ctrl(calc, inpStr, outStr);
+		calc.AddVariableWithValue("x", "1");
+		calc.AddFunctionWithOperation("f", "g+x");
+		calc.AddFunctionWithOperation("g", "x*2");
+		calc.AddFunctionWithOperation("h", "x+1");
+		REQUIRE(calc.GetFunctionValue("f") == Catch::Approx(3));
+		calc.AddFunctionWithOperation("g", "f+x");
+
+		THEN("Functions in the cycle are NAN and the rest is printed")
+		{
+			inpStr << "printfns\n"s;
+			REQUIRE(ctrl.HandleCommand());
+			REQUIRE(outStr.str() == "f:nan\ng:nan\nh:2.00\n"s);
+		}
+
+		THEN("Breaking the cycle restores the values")
+		{
+			REQUIRE(std::isnan(calc.GetFunctionValue("g")));
+			calc.AddFunctionWithOperation("g", "x*3");
+			REQUIRE(calc.GetFunctionValue("f") == Catch::Approx(4));
+		}
+	}
+}
+
+SCENARIO("Command and evaluation stats")
+{
+	GIVEN("Control with stats enabled")
+	{
+		CCalculator calc;
+		stringstream inpStr;
+		stringstream outStr;
+		CControl ctrl(calc, inpStr, outStr);
+		inpStr << "let x=1\n"s;
+		ctrl.HandleCommand();
+		REQUIRE(ctrl.GetCommandStats().empty());
+		inpStr << "stats on\n"s;
+		REQUIRE(ctrl.HandleCommand());
+
+		WHEN("Commands are executed")
+		{
+			for (const string& line: { "let x=2"s, "let 1=2"s, "fn f=x+1"s, "fn g=f*2"s, "print g"s, "print g"s })
+			{
+				inpStr << line << '\n';
+				ctrl.HandleCommand();
+			}
+
+			THEN("Every action is counted and timed")
+			{
+				const auto& stats = ctrl.GetCommandStats();
+				REQUIRE(stats.at("let").count == 2);
+				REQUIRE(stats.at("let").failures == 1);
+				REQUIRE(stats.at("fn").count == 2);
+				REQUIRE(stats.at("print").count == 2);
+				size_t bucketTotal = 0;
+				for (size_t bucket: stats.at("print").latencyBuckets)
+				{
+					bucketTotal += bucket;
+				}
+				REQUIRE(bucketTotal == 2);
+				REQUIRE_FALSE(stats.contains("var"));
+			}
+
+			THEN("Evaluation is counted")
+			{
+				const EvaluationStats& evaluation = calc.GetEvaluationStats();
+				REQUIRE(evaluation.nodeVisits == 2);
+				REQUIRE(evaluation.cacheHits == 1);
+				REQUIRE(evaluation.maxDepth == 2);
+			}
+
+			THEN("Stats command prints them")
+			{
+				outStr.str(""s);
+				inpStr << "stats\n"s;
+				REQUIRE(ctrl.HandleCommand());
+				string printed = outStr.str();
+				REQUIRE(printed.find("let:2 calls, 1 failed, avg ") != string::npos);
+				REQUIRE(printed.find("print:2 calls, 0 failed, avg ") != string::npos);
+				REQUIRE(printed.find("eval:2 visits, 1 cache hits, 2 max depth\n") != string::npos);
+			}
+
+			THEN("Printing all functions records the depth of the longest chain")
+			{
+				inpStr << "stats reset\nfn h=g+f\nfn k=h-1\nprintfns\n"s;
+				for (int i = 0; i < 4; ++i)
+				{
+					REQUIRE(ctrl.HandleCommand());
+				}
+				REQUIRE(calc.GetEvaluationStats().maxDepth == 2);
+				inpStr << "let x=3\nstats reset\nprintfns\n"s;
+				for (int i = 0; i < 3; ++i)
+				{
+					REQUIRE(ctrl.HandleCommand());
+				}
+				REQUIRE(calc.GetEvaluationStats().nodeVisits == 4);
+				REQUIRE(calc.GetEvaluationStats().maxDepth == 4);
+			}
+
+			THEN("Stats can be reset and switched off")
+			{
+				inpStr << "stats reset\n"s;
+				REQUIRE(ctrl.HandleCommand());
+				inpStr << "stats off\n"s;
+				REQUIRE(ctrl.HandleCommand());
+				inpStr << "print g\n"s;
+				REQUIRE(ctrl.HandleCommand());
+				REQUIRE(ctrl.GetCommandStats().size() == 1);
+				REQUIRE(calc.GetEvaluationStats().cacheHits == 0);
+				inpStr << "stats sometimes\n"s;
+				REQUIRE_FALSE(ctrl.HandleCommand());
+			}
+		}
+	}
+}
+
+SCENARIO("Remainder, power, min and max")
+{
+	GIVEN("Calc with a and b")
+	{
+		CCalculator calc;
+		calc.AddVariableWithValue("a", "7");
+		calc.AddVariableWithValue("b", "-2");
+
+		WHEN("Functions use the new operations")
+		{
+			REQUIRE(calc.AddFunctionWithOperation("rem", "a%3"));
+			REQUIRE(calc.AddFunctionWithOperation("powers", "2^3^2"));
+			REQUIRE(calc.AddFunctionWithOperation("negpow", "-2^2"));
+			REQUIRE(calc.AddFunctionWithOperation("mixed", "a*2^b%3"));
+			REQUIRE(calc.AddFunctionWithOperation("lo", "min(a, b*5)"));
+			REQUIRE(calc.AddFunctionWithOperation("hi", "max(min(a,0), b)+1"));
+			REQUIRE(calc.AddFunctionWithOperation("nanmin", "min(a, undefined)"));
+			calc.AddVariableWithValue("min", "4");
+			REQUIRE(calc.AddFunctionWithOperation("plain", "min*2"));
+
+			THEN("Precedence and associativity are the usual ones")
+			{
+				REQUIRE(calc.GetFunctionValue("rem") == Catch::Approx(1));
+				REQUIRE(calc.GetFunctionValue("powers") == Catch::Approx(512));
+				REQUIRE(calc.GetFunctionValue("negpow") == Catch::Approx(-4));
+				REQUIRE(calc.GetFunctionValue("mixed") == Catch::Approx(1.75));
+				REQUIRE(calc.GetFunctionValue("lo") == Catch::Approx(-10));
+				REQUIRE(calc.GetFunctionValue("hi") == Catch::Approx(1));
+				REQUIRE(std::isnan(calc.GetFunctionValue("nanmin")));
+				REQUIRE(calc.GetFunctionValue("plain") == Catch::Approx(8));
+			}
+
+			THEN("Sweep gives the same values as single evaluation")
+			{
+				auto results = calc.Sweep("mixed", "a", { 1, 2, 3, 4, 5, 6, 7 });
+				for (size_t i = 0; i < results.size(); ++i)
+				{
+					calc.AddVariableWithValue("a", static_cast<double>(i + 1));
+					REQUIRE(results[i] == Catch::Approx(calc.GetFunctionValue("mixed")));
+				}
+			}
+		}
+
+		WHEN("Calls are malformed")
+		{
+			THEN("They do not compile")
+			{
+				REQUIRE_FALSE(calc.AddFunctionWithOperation("f", "min(a)"));
+				REQUIRE_FALSE(calc.AddFunctionWithOperation("f", "max(a,b,a)"));
+				REQUIRE_FALSE(calc.AddFunctionWithOperation("f", "a^"));
+				REQUIRE_FALSE(calc.AddFunctionWithOperation("f", "a,b"));
+				REQUIRE_FALSE(calc.GetIdentifierType("f").has_value());
+			}
+		}
+	}
+}
+
+SCENARIO("Bulk import of variables")
+{
+	GIVEN("Calc with a variable and a function over it")
+	{
+		CCalculator calc;
+		stringstream inpStr;
+		stringstream outStr;
+		CControl ctrl(calc, inpStr, outStr);
+		calc.AddVariableWithValue("x", "1");
+		calc.AddFunctionWithOperation("f", "x+y");
+		REQUIRE(std::isnan(calc.GetFunctionValue("f")));
+
+		WHEN("Rows are imported")
+		{
+			REQUIRE(calc.ImportVariables("name,value\r\nx, 2.5\r\ny,-1e1\n\nz,+3\nx,4"sv));
+
+			THEN("Variables are created or updated and dependents see the new values")
+			{
+				REQUIRE(calc.GetVariableValueByName("x") == Catch::Approx(4));
+				REQUIRE(calc.GetVariableValueByName("y") == Catch::Approx(-10));
+				REQUIRE(calc.GetVariableValueByName("z") == Catch::Approx(3));
+				REQUIRE(calc.GetFunctionValue("f") == Catch::Approx(-6));
+				REQUIRE(calc.GetAllVariables().size() == 4);
+			}
+		}
+
+		WHEN("A row is malformed or names a function")
+		{
+			THEN("Nothing is imported")
+			{
+				REQUIRE_FALSE(calc.ImportVariables("y,1\nz,abc\n"sv));
+				REQUIRE_FALSE(calc.ImportVariables("y,1\n1z,2\n"sv));
+				REQUIRE_FALSE(calc.ImportVariables("y,1\nz\n"sv));
+				REQUIRE_FALSE(calc.ImportVariables("y,1\nf,2\n"sv));
+				REQUIRE_FALSE(calc.GetIdentifierType("y") == IdentifierType::VARIABLE);
+				REQUIRE(calc.GetVariableValueByName("x") == Catch::Approx(1));
+			}
+		}
+
+		WHEN("Import command reads a file")
+		{
+			string path = (filesystem::temp_directory_path() / "calculator_import_test.csv").string();
+			ofstream(path) << "x,10\ny,20\n";
+			inpStr << "import " << path << '\n';
+			REQUIRE(ctrl.HandleCommand());
+			inpStr << "import " << path << ".missing\n";
+			REQUIRE_FALSE(ctrl.HandleCommand());
+			inpStr << "print f\n"s;
+			REQUIRE(ctrl.HandleCommand());
+			filesystem::remove(path);
+
+			THEN("Values are loaded and errors reported")
+			{
+				REQUIRE(outStr.str() == "Import not possible\n30.00\n"s);
+			}
+		}
+	}
+}
+
+// sends everything, closes the sending side and returns all replies
+string RunSocketClient(const string& path, const vector<string>& pieces)
+{
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	sockaddr_un address{};
+	address.sun_family = AF_UNIX;
+	path.copy(address.sun_path, sizeof(address.sun_path) - 1);
+	if (fd == -1 || connect(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == -1)
+	{
+		return "connect failed";
+	}
+	for (const string& piece: pieces)
+	{
+		send(fd, piece.data(), piece.size(), MSG_NOSIGNAL);
+	}
+	shutdown(fd, SHUT_WR);
+	string reply;
+	char buffer[4096];
+	for (ssize_t size; (size = recv(fd, buffer, sizeof(buffer), 0)) > 0;)
+	{
+		reply.append(buffer, static_cast<size_t>(size));
+	}
+	close(fd);
+	return reply;
+}
+
+SCENARIO("Server shares one calculator between socket clients")
+{
+	GIVEN("Server running in a thread")
+	{
+		CCalculator calc;
+		CServer server(calc);
+		string path = (filesystem::temp_directory_path() / "calculator_server_test.sock").string();
+		REQUIRE(server.Listen(path));
+		bool runResult = false;
+		jthread serverThread([&] { runResult = server.Run(); });
+
+		WHEN("Clients pipeline commands, split lines between writes and leave the last one unterminated")
+		{
+			string first = RunSocketClient(path, { "let x=2\nfn f=x*10\nprint f\npr", "int x\nvar x\n", "print y" });
+			string second = RunSocketClient(path, { "let x=3\nprint f\n" });
+			string large;
+			string commands;
+			for (int i = 0; i < 20000; ++i)
+			{
+				commands += "print f\n";
+			}
+			large = RunSocketClient(path, { commands });
+			server.Stop();
+			serverThread.join();
+
+			THEN("Each client gets its replies in order and sees the others' changes")
+			{
+				REQUIRE(runResult);
+				REQUIRE(first == "20.00\n2.00\nVariable already exist\nVariable not exist\n"s);
+				REQUIRE(second == "30.00\n"s);
+				REQUIRE(large.size() == 20000 * "30.00\n"s.size());
+				REQUIRE(calc.GetVariableValueByName("x") == Catch::Approx(3));
+			}
+		}
+
+		WHEN("A client disconnects with a batch open")
+		{
+			string first = RunSocketClient(path, { "let x=1\nbegin\nlet x=5\n" });
+			string second = RunSocketClient(path, { "let x=2\nprint x\nbegin\ncommit\n" });
+			server.Stop();
+			serverThread.join();
+
+			THEN("Its batch is dropped and other clients are not affected")
+			{
+				REQUIRE(first.empty());
+				REQUIRE(second == "2\n"s);
+				REQUIRE(calc.GetVariableValueByName("x") == Catch::Approx(2));
+			}
+		}
+
+		WHEN("A client sends a line longer than the server accepts")
+		{
+			string tooLong = RunSocketClient(path, { "let x=5\nlet y=", string(5 << 20, '1') });
+			string next = RunSocketClient(path, { "print x\nprint y\n" });
+			server.Stop();
+			serverThread.join();
+
+			THEN("Its connection is closed and the server keeps serving others")
+			{
+				REQUIRE(runResult);
+				// the reply may be lost when the server closes before reading everything
+				REQUIRE((tooLong.empty() || tooLong == "Line too long\n"s));
+				REQUIRE(next == "5\nVariable not exist\n"s);
+			}
+		}
+	}
+}
+
+SCENARIO("Compiled evaluation plans")
+{
+	GIVEN("Calc with a diamond of functions, a function referring to a variable and a forward reference")
+	{
+		CCalculator calc;
+		calc.AddVariableWithValue("x", "2");
+		calc.AddVariableWithValue("y", "3");
+		calc.AddFunctionWithVariable("ref", "y");
+		calc.AddFunctionWithOperation("a", "x*x+1");
+		calc.AddFunctionWithOperation("b", "-a/y");
+		calc.AddFunctionWithOperation("top", "max(a, b)^2 - b + ref + later");
+		REQUIRE(calc.CompileFunction("top"));
+		REQUIRE_FALSE(calc.CompileFunction("x"));
+		REQUIRE_FALSE(calc.CompileFunction("missing"));
+
+		WHEN("Variables change")
+		{
+			THEN("Plan agrees with recursive evaluation")
+			{
+				REQUIRE(std::isnan(calc.EvaluateCompiledFunction("top")));
+				calc.AddVariableWithValue("later", "1");
+				for (double x: { 2.0, -1.5, 0.0, 10.0 })
+				{
+					calc.AddVariableWithValue("x", x);
+					REQUIRE(calc.EvaluateCompiledFunction("top") == Catch::Approx(calc.GetFunctionValue("top")));
+				}
+				REQUIRE(calc.EvaluateCompiledFunction("b") == Catch::Approx(calc.GetFunctionValue("b")));
+				calc.AddVariableWithValue("y", "5");
+				REQUIRE(calc.EvaluateCompiledFunction("top") == Catch::Approx(calc.GetFunctionValue("top")));
+			}
+		}
+
+		WHEN("A function of the closure is redefined")
+		{
+			calc.AddVariableWithValue("later", "0");
+			calc.AddFunctionWithOperation("a", "x");
+			calc.AddFunctionWithOperation("unrelated", "y");
+
+			THEN("Plan is rebuilt from the new definition")
+			{
+				REQUIRE(calc.EvaluateCompiledFunction("top") == Catch::Approx(calc.GetFunctionValue("top")));
+				REQUIRE(calc.EvaluateCompiledFunction("top") == Catch::Approx(4 + 2.0 / 3 + 3));
+			}
+		}
+
+		WHEN("A leaf of the closure becomes a function")
+		{
+			calc.AddFunctionWithOperation("later", "y*100");
+
+			THEN("It is inlined into the new plan")
+			{
+				REQUIRE(calc.EvaluateCompiledFunction("top") == Catch::Approx(calc.GetFunctionValue("top")));
+			}
+		}
+
+		WHEN("The closure contains a cycle")
+		{
+			calc.AddFunctionWithOperation("a", "top+1");
+
+			THEN("Plan gives NAN until the cycle is broken")
+			{
+				REQUIRE(std::isnan(calc.EvaluateCompiledFunction("top")));
+				calc.AddFunctionWithOperation("a", "1");
+				calc.AddVariableWithValue("later", "0");
+				REQUIRE(calc.EvaluateCompiledFunction("top") == Catch::Approx(calc.GetFunctionValue("top")));
+			}
+		}
+	}
+
+	GIVEN("Chain of 100000 functions")
+	{
+		CCalculator calc;
+		calc.AddVariableWithValue("x", "1");
+		calc.AddFunctionWithOperation("f0", "x+1");
+		for (int i = 1; i < 100000; ++i)
+		{
+			calc.AddFunctionWithOperation("f" + to_string(i), "f" + to_string(i - 1) + "+x");
+		}
+
+		THEN("Plan evaluates it without recursion")
+		{
+			REQUIRE(calc.EvaluateCompiledFunction("f99999") == Catch::Approx(100001));
+			calc.AddVariableWithValue("x", "2");
+			REQUIRE(calc.EvaluateCompiledFunction("f99999") == Catch::Approx(200002));
+		}
+	}
+}
+
+SCENARIO("Listings stay sorted as identifiers are added and change kind")
+{
+	GIVEN("Calc listed once")
+	{
+		CCalculator calc;
+		stringstream inpStr;
+		stringstream outStr;
+		CControl ctrl(calc, inpStr, outStr);
+		calc.AddVariableWithValue("z", "-0.005");
+		calc.AddVariableWithValue("a", "1e20");
+		calc.AddFunctionWithOperation("g", "a*0+2.125");
+		inpStr << "printvars\nprintfns\n"s;
+		ctrl.HandleCommand();
+		ctrl.HandleCommand();
+		REQUIRE(outStr.str() == "a:100000000000000000000.00\nz:-0.01\ng:2.12\n"s);
+
+		WHEN("More identifiers are declared and one changes kind")
+		{
+			outStr.str(""s);
+			calc.AddVariable("m");
+			calc.AddVariable("q");
+			calc.AddVariableWithValue("b", "1");
+			calc.AddFunctionWithOperation("c", "b+1");
+			calc.AddFunctionWithOperation("q", "b*3");
+			calc.AddVariableWithValue("z", "-1");
+			inpStr << "printvars\nprintfns\n"s;
+			ctrl.HandleCommand();
+			ctrl.HandleCommand();
+
+			THEN("Each listing has its kind only, in name order")
+			{
+				REQUIRE(outStr.str() == "a:100000000000000000000.00\nb:1.00\nm:nan\nz:-1.00\nc:2.00\ng:2.12\nq:3.00\n"s);
+			}
+
+			THEN("An identifier that changes kind back is listed once")
+			{
+				outStr.str(""s);
+				calc.AddVariableWithValue("q", "7");
+				calc.AddFunctionWithOperation("m", "1");
+				calc.AddVariableWithValue("m", "2");
+				inpStr << "printvars\n"s;
+				ctrl.HandleCommand();
+				REQUIRE(outStr.str() == "a:100000000000000000000.00\nb:1.00\nm:2.00\nq:7.00\nz:-1.00\n"s);
+			}
+		}
+	}
+}
+
+SCENARIO("Batch updates")
+{
+	GIVEN("Reactive calc with functions over x and y")
+	{
+		CCalculator calc;
+		stringstream inpStr;
+		stringstream outStr;
+		CControl ctrl(calc, inpStr, outStr);
+		calc.AddVariableWithValue("x", "1");
+		calc.AddVariableWithValue("y", "2");
+		calc.AddFunctionWithOperation("sum", "x+y");
+		calc.SetReactive(true);
+
+		WHEN("Updates are made inside a batch")
+		{
+			inpStr << "begin\nlet x=10\nlet y=x\nvar z\nlet w=y\nprint x\nprint sum\n"s;
+			for (int i = 0; i < 7; ++i)
+			{
+				REQUIRE(ctrl.HandleCommand());
+			}
+
+			THEN("Readers see the old values until commit")
+			{
+				REQUIRE(outStr.str() == "1\n3.00\n"s);
+				REQUIRE(calc.TakeChanges().empty());
+				REQUIRE_FALSE(calc.GetIdentifierType("z").has_value());
+				inpStr << "begin\ncommit\ncommit\n"s;
+				REQUIRE_FALSE(ctrl.HandleCommand());
+				REQUIRE(ctrl.HandleCommand());
+				REQUIRE_FALSE(ctrl.HandleCommand());
+				REQUIRE(calc.GetVariableValueByName("x") == Catch::Approx(10));
+				REQUIRE(calc.GetVariableValueByName("w") == Catch::Approx(10));
+				REQUIRE(calc.GetIdentifierType("z") == IdentifierType::VARIABLE);
+				REQUIRE(calc.GetFunctionValue("sum") == Catch::Approx(20));
+				auto changes = calc.TakeChanges();
+				REQUIRE(changes.size() == 1);
+				REQUIRE(changes[0].oldValue == Catch::Approx(3));
+				REQUIRE(outStr.str() == "1\n3.00\nBatch already open\nNo open batch\n"s);
+			}
+
+			THEN("Rollback discards them")
+			{
+				inpStr << "rollback\nrollback\n"s;
+				REQUIRE(ctrl.HandleCommand());
+				REQUIRE_FALSE(ctrl.HandleCommand());
+				REQUIRE(calc.GetVariableValueByName("x") == Catch::Approx(1));
+				REQUIRE(calc.GetFunctionValue("sum") == Catch::Approx(3));
+				REQUIRE_FALSE(calc.GetIdentifierType("w").has_value());
+				REQUIRE(calc.TakeChanges().empty());
+			}
+		}
+
+		WHEN("A variable is declared twice in one batch and then imported")
+		{
+			string path = (filesystem::temp_directory_path() / "calculator_batch_test.csv").string();
+			ofstream(path) << "x,5\nv,6\n";
+			inpStr << "begin\nvar v\nvar v\nvar x\nimport " << path << "\ncommit\n";
+			for (bool expected: { true, true, false, false, true, true })
+			{
+				REQUIRE(ctrl.HandleCommand() == expected);
+			}
+			filesystem::remove(path);
+
+			THEN("The last buffered value wins")
+			{
+				REQUIRE(outStr.str() == "Variable already exist\nVariable already exist\n"s);
+				REQUIRE(calc.GetVariableValueByName("v") == Catch::Approx(6));
+				REQUIRE(calc.GetFunctionValue("sum") == Catch::Approx(7));
+			}
+		}
+
+		WHEN("A function is declared over a name pending in the batch")
+		{
+			inpStr << "begin\nlet v=1\nfn v=x+1\nfn g=v*2\ncommit\n"s;
+			for (bool expected: { true, true, false, true, true })
+			{
+				REQUIRE(ctrl.HandleCommand() == expected);
+			}
+
+			THEN("It is rejected and the variable is committed")
+			{
+				REQUIRE(outStr.str() == "Identifier already exist\n"s);
+				REQUIRE(calc.GetIdentifierType("v") == IdentifierType::VARIABLE);
+				REQUIRE(calc.GetFunctionValue("g") == Catch::Approx(2));
+			}
+		}
+
+		WHEN("A name of the batch becomes a function before commit")
+		{
+			CControl other(calc, inpStr, outStr);
+			inpStr << "begin\nlet v=1\nlet x=7\nfn v=y+1\ncommit\n"s;
+			REQUIRE(ctrl.HandleCommand());
+			REQUIRE(ctrl.HandleCommand());
+			REQUIRE(ctrl.HandleCommand());
+			REQUIRE(other.HandleCommand());
+			REQUIRE_FALSE(ctrl.HandleCommand());
+
+			THEN("Nothing of the batch is applied and the function stays")
+			{
+				REQUIRE(outStr.str() == "Cannot assign value to function\n"s);
+				REQUIRE(calc.GetIdentifierType("v") == IdentifierType::FUNCTION);
+				REQUIRE(calc.GetVariableValueByName("x") == Catch::Approx(1));
+				REQUIRE(calc.AssignVariables(vector<pair<string_view, double>>{ { "x", 3 }, { "y", 4 } }));
+				REQUIRE_FALSE(calc.AssignVariables(vector<pair<string_view, double>>{ { "x", 5 }, { "v", 4 } }));
+				REQUIRE(calc.GetFunctionValue("sum") == Catch::Approx(7));
+				REQUIRE(calc.GetFunctionValue("v") == Catch::Approx(5));
+			}
+		}
+
+		WHEN("Two controls share the calculator")
+		{
+			CControl other(calc, inpStr, outStr);
+			inpStr << "begin\nlet x=5\nlet x=2\nprint x\nbegin\nrollback\n"s;
+			REQUIRE(ctrl.HandleCommand());
+			REQUIRE(ctrl.HandleCommand());
+			for (int i = 0; i < 4; ++i)
+			{
+				REQUIRE(other.HandleCommand());
+			}
+
+			THEN("Each has its own batch")
+			{
+				REQUIRE(outStr.str() == "2\n"s);
+				inpStr << "commit\n"s;
+				REQUIRE(ctrl.HandleCommand());
+				REQUIRE(calc.GetVariableValueByName("x") == Catch::Approx(5));
+			}
+		}
+	}
+}
+
+TEST_CASE("Find gives handles of declared identifiers")
+{
+	CCalculator calc;
+	calc.AddVariableWithValue("x", "4");
+	calc.AddFunctionWithOperation("f", "x*later");
+	calc.AddVariableWithValue("later", "2");
+	calc.AddFunctionWithOperation("g", "undeclared+1");
+
+	auto x = calc.Find("x");
+	auto f = calc.Find("f");
+	REQUIRE(x.has_value());
+	REQUIRE(f.has_value());
+	REQUIRE(calc.GetType(*x) == IdentifierType::VARIABLE);
+	REQUIRE(calc.GetType(*f) == IdentifierType::FUNCTION);
+	REQUIRE(calc.GetName(*f) == "f");
+	REQUIRE(calc.GetValue(*f) == Catch::Approx(8));
+	REQUIRE_FALSE(calc.Find("undeclared").has_value());
+	REQUIRE_FALSE(calc.Find("missing").has_value());
+}